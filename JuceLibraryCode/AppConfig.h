@@ -18,6 +18,10 @@
 
 // (You can add your own code in this section, and the Projucer will not overwrite it)
 
+// trace spans, compiled in with -DLOOP4R_TRACE=1, also mark the OSC classes' internals
+#include "../Source/Trace.h"
+#define JUCE_OSC_TRACE_SCOPE(name) LOOP4R_TRACE_SCOPE(name)
+
 // [END_USER_CODE_SECTION]
 
 /*
@@ -35,6 +35,8 @@
 
 #include "juce_osc.h"
 
+#include <unordered_map>
+
 #include "osc/juce_OSCTypes.cpp"
 #include "osc/juce_OSCTimeTag.cpp"
 #include "osc/juce_OSCArgument.cpp"
@@ -54,6 +54,16 @@
 #include <juce_core/juce_core.h>
 #include <juce_events/juce_events.h>
 
+//==============================================================================
+/** Config: JUCE_OSC_TRACE_SCOPE
+    A macro taking a string literal, placed at the top of the sender's and the
+    receiver's main internal steps so they can be timed by a profiler. It
+    expands to nothing by default.
+*/
+#ifndef JUCE_OSC_TRACE_SCOPE
+ #define JUCE_OSC_TRACE_SCOPE(name)
+#endif
+
 //==============================================================================
 #include "osc/juce_OSCTypes.h"
 #include "osc/juce_OSCTimeTag.h"
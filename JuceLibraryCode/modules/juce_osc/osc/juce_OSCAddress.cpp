@@ -30,6 +30,488 @@ namespace juce
 namespace
 {
     //==============================================================================
+    /*  Compiles OSC address pattern parts into a small bytecode, and matches it
+        against raw address bytes without allocating.
+
+        A compiled pattern is a sequence of parts, one for each part of the address
+        between slashes. Each part starts with its length in two bytes, followed by
+        its instructions and an opEnd. The instructions are:
+
+            opLiteral n c...    the next n chars are c...
+            opAnyChar           '?'
+            opAnyOrNoChars      '*'
+            opCharSet bitmap    '[...]', one bit for each byte value in 32 bytes,
+                                with a negated set already inverted
+            opStringSet len     '{...}', len bytes of elements follow, each one
+                                a length byte and its chars
+            opFail              a malformed expression, which never matches
+
+        The semantics are exactly those of the old interpreting matcher, including
+        its treatment of malformed expressions (see the unit tests below).
+    */
+    struct OSCPatternCompiler
+    {
+        enum : uint8
+        {
+            opEnd,
+            opLiteral,
+            opAnyChar,
+            opAnyOrNoChars,
+            opCharSet,
+            opStringSet,
+            opFail
+        };
+
+        //==============================================================================
+        static void compile (const StringArray& oscSymbols, Array<uint8>& program)
+        {
+            program.clearQuick();
+
+            for (auto& symbol : oscSymbols)
+                compilePart (symbol.toRawUTF8(), symbol.getNumBytesAsUTF8(), program);
+        }
+
+        static void compilePart (const char* pattern, size_t numBytes, Array<uint8>& program)
+        {
+            auto partStart = program.size();
+            program.add (0);
+            program.add (0);
+
+            if (! compileInstructions (pattern, pattern + numBytes, program))
+            {
+                program.removeRange (partStart + 2, program.size());
+                program.add (opFail);
+            }
+
+            program.add (opEnd);
+
+            auto partSize = program.size() - partStart - 2;
+            program.set (partStart, (uint8) (partSize & 0xff));
+            program.set (partStart + 1, (uint8) (partSize >> 8));
+        }
+
+        //==============================================================================
+        // true if the compiled parts match the address, whose empty parts are skipped
+        // like OSCAddress does
+        static bool match (const uint8* program, const uint8* programEnd, const char* address, const char* addressEnd) noexcept
+        {
+            for (;;)
+            {
+                while (address != addressEnd && *address == '/')
+                    ++address;
+
+                if (program == programEnd)
+                    return address == addressEnd;
+
+                if (address == addressEnd)
+                    return false;
+
+                auto partEnd = address;
+                while (partEnd != addressEnd && *partEnd != '/')
+                    ++partEnd;
+
+                auto partSize = (size_t) program[0] | ((size_t) program[1] << 8);
+
+                if (! matchPart (program + 2, address, partEnd))
+                    return false;
+
+                program += 2 + partSize;
+                address = partEnd;
+            }
+        }
+
+        static bool matchPart (const uint8* pc, const char* target, const char* targetEnd) noexcept
+        {
+            for (;;)
+            {
+                switch (*pc++)
+                {
+                    case opEnd:
+                        return target == targetEnd;
+
+                    case opLiteral:
+                    {
+                        auto length = *pc++;
+
+                        if (targetEnd - target < length || memcmp (pc, target, length) != 0)
+                            return false;
+
+                        pc += length;
+                        target += length;
+                        break;
+                    }
+
+                    case opAnyChar:
+                        if (target == targetEnd)
+                            return false;
+
+                        ++target;
+                        break;
+
+                    case opAnyOrNoChars:
+                        // as before, a '*' at the end of the target only matches if nothing follows it
+                        for (; target != targetEnd; ++target)
+                            if (matchPart (pc, target, targetEnd))
+                                return true;
+
+                        return *pc == opEnd;
+
+                    case opCharSet:
+                    {
+                        if (target == targetEnd)
+                            return false;
+
+                        auto c = (uint8) *target++;
+
+                        if ((pc[c >> 3] & (1 << (c & 7))) == 0)
+                            return false;
+
+                        pc += 32;
+                        break;
+                    }
+
+                    case opStringSet:
+                    {
+                        auto setSize = (size_t) pc[0] | ((size_t) pc[1] << 8);
+                        auto element = pc + 2;
+                        auto rest = element + setSize;
+
+                        for (; element < rest; element += 1 + *element)
+                        {
+                            auto length = *element;
+
+                            if (targetEnd - target >= length
+                                 && memcmp (element + 1, target, length) == 0
+                                 && matchPart (rest, target + length, targetEnd))
+                                return true;
+                        }
+
+                        return false;
+                    }
+
+                    default:
+                        return false;
+                }
+            }
+        }
+
+    private:
+        //==============================================================================
+        static bool compileInstructions (const char* pattern, const char* patternEnd, Array<uint8>& program)
+        {
+            int literalStart = -1;
+
+            while (pattern != patternEnd)
+            {
+                auto c = *pattern++;
+
+                if (c != '?' && c != '*' && c != '{' && c != '[')
+                {
+                    if (literalStart < 0 || program[literalStart + 1] == 255)
+                    {
+                        literalStart = program.size();
+                        program.add (opLiteral);
+                        program.add (0);
+                    }
+
+                    program.add ((uint8) c);
+                    program.set (literalStart + 1, (uint8) (program[literalStart + 1] + 1));
+                    continue;
+                }
+
+                literalStart = -1;
+
+                if (c == '?')
+                    program.add (opAnyChar);
+                else if (c == '*')
+                    program.add (opAnyOrNoChars);
+                else if (c == '{' ? ! compileStringSet (pattern, patternEnd, program)
+                                  : ! compileCharSet (pattern, patternEnd, program))
+                    return false;
+            }
+
+            return true;
+        }
+
+        //==============================================================================
+        static bool compileStringSet (const char*& pattern, const char* patternEnd, Array<uint8>& program)
+        {
+            auto setStart = program.size();
+            program.add (opStringSet);
+            program.add (0);
+            program.add (0);
+
+            auto elementStart = program.size();
+            program.add (0);
+
+            while (pattern != patternEnd)
+            {
+                auto c = *pattern++;
+
+                if (c == '}' || c == ',')
+                {
+                    auto length = program.size() - elementStart - 1;
+
+                    if (length > 255)
+                        return false;
+
+                    program.set (elementStart, (uint8) length);
+
+                    if (c == '}')
+                    {
+                        auto setSize = program.size() - setStart - 3;
+
+                        if (setSize > 0xffff)
+                            return false;
+
+                        program.set (setStart + 1, (uint8) (setSize & 0xff));
+                        program.set (setStart + 2, (uint8) (setSize >> 8));
+                        return true;
+                    }
+
+                    elementStart = program.size();
+                    program.add (0);
+                    continue;
+                }
+
+                program.add ((uint8) c);
+            }
+
+            return false;
+        }
+
+        //==============================================================================
+        static bool compileCharSet (const char*& pattern, const char* patternEnd, Array<uint8>& program)
+        {
+            uint8 bitmap[32] = {};
+            bool isEmpty = true, isNegated = false;
+            int last = 0;
+
+            auto add = [&] (int c)
+            {
+                bitmap[(c & 0xff) >> 3] |= (uint8) (1 << (c & 7));
+                last = c;
+                isEmpty = false;
+            };
+
+            while (pattern != patternEnd)
+            {
+                auto c = (uint8) *pattern++;
+
+                if (c == ']')
+                {
+                    // an empty set matches without taking a char, like "{}", which it
+                    // becomes so that a '*' before it still sees something following
+                    if (isEmpty)
+                    {
+                        program.addArray ({ (uint8) opStringSet, (uint8) 1, (uint8) 0, (uint8) 0 });
+                        return true;
+                    }
+
+                    program.add (opCharSet);
+
+                    for (auto bits : bitmap)
+                        program.add (isNegated ? (uint8) ~bits : bits);
+
+                    return true;
+                }
+
+                if (c == '-')
+                {
+                    if (pattern == patternEnd)
+                        return false;
+
+                    // the range's end is added again as an ordinary char on the next pass
+                    auto rangeEnd = (uint8) *pattern;
+
+                    if (rangeEnd == ']')
+                    {
+                        add ('-');  // special case: '-' has no special meaning at the end.
+                        continue;
+                    }
+
+                    if (rangeEnd == ',' || rangeEnd == '{' || rangeEnd == '}' || isEmpty)
+                        return false;
+
+                    for (auto r = last + 1; r <= rangeEnd; ++r)
+                        add (r);
+
+                    continue;
+                }
+
+                if (c == '!' && isEmpty && ! isNegated)
+                {
+                    isNegated = true;
+                    continue;
+                }
+
+                add (c);
+            }
+
+            return false;
+        }
+    };
+
+    //==============================================================================
+    template <typename OSCAddressType> struct OSCAddressTokeniserTraits;
+    template <> struct OSCAddressTokeniserTraits<OSCAddress>        { static const char* getDisallowedChars() { return " #*,?/[]{}"; } };
+    template <> struct OSCAddressTokeniserTraits<OSCAddressPattern> { static const char* getDisallowedChars() { return " #/"; } };
+
+    //==============================================================================
+    template <typename OSCAddressType>
+    struct OSCAddressTokeniser
+    {
+        using Traits = OSCAddressTokeniserTraits<OSCAddressType>;
+
+        //==============================================================================
+        static bool isPrintableASCIIChar (juce_wchar c) noexcept
+        {
+            return c >= ' ' && c <= '~';
+        }
+
+        static bool isDisallowedChar (juce_wchar c) noexcept
+        {
+            return CharPointer_ASCII (Traits::getDisallowedChars()).indexOf (c, false) >= 0;
+        }
+
+        static bool containsOnlyAllowedPrintableASCIIChars (const String& string) noexcept
+        {
+            for (auto charPtr = string.getCharPointer(); ! charPtr.isEmpty();)
+            {
+                auto c = charPtr.getAndAdvance();
+
+                if (! isPrintableASCIIChar (c) || isDisallowedChar (c))
+                    return false;
+            }
+
+            return true;
+        }
+
+        //==============================================================================
+        static StringArray tokenise (const String& address)
+        {
+            if (address.isEmpty())
+                throw OSCFormatError ("OSC format error: address string cannot be empty.");
+
+            if (! address.startsWithChar ('/'))
+                throw OSCFormatError ("OSC format error: address string must start with a forward slash.");
+
+            StringArray oscSymbols;
+            oscSymbols.addTokens (address, "/", StringRef());
+            oscSymbols.removeEmptyStrings (false);
+
+            for (auto& token : oscSymbols)
+                if (! containsOnlyAllowedPrintableASCIIChars (token))
+                    throw OSCFormatError ("OSC format error: encountered characters not allowed in address string.");
+
+            return oscSymbols;
+        }
+    };
+
+}  // namespace
+
+//==============================================================================
+OSCAddress::OSCAddress (const String& address)
+    : oscSymbols (OSCAddressTokeniser<OSCAddress>::tokenise (address)),
+      asString (address.trimCharactersAtEnd ("/"))
+{
+}
+
+OSCAddress::OSCAddress (const char* address)
+    : oscSymbols (OSCAddressTokeniser<OSCAddress>::tokenise (String (address))),
+      asString (String (address).trimCharactersAtEnd ("/"))
+{
+}
+
+//==============================================================================
+bool OSCAddress::operator== (const OSCAddress& other) const noexcept
+{
+    return asString == other.asString;
+}
+
+bool OSCAddress::operator!= (const OSCAddress& other) const noexcept
+{
+    return ! operator== (other);
+}
+
+//==============================================================================
+String OSCAddress::toString() const noexcept
+{
+    return asString;
+}
+
+//==============================================================================
+OSCAddressPattern::OSCAddressPattern (const String& address)
+    : oscSymbols (OSCAddressTokeniser<OSCAddressPattern>::tokenise (address)),
+      asString (address.trimCharactersAtEnd ("/")),
+      wasInitialisedWithWildcards (asString.containsAnyOf ("*?{}[]"))
+
+{
+    if (wasInitialisedWithWildcards)
+        OSCPatternCompiler::compile (oscSymbols, program);
+}
+
+OSCAddressPattern::OSCAddressPattern (const char* address)
+    : oscSymbols (OSCAddressTokeniser<OSCAddressPattern>::tokenise (String (address))),
+      asString (String (address).trimCharactersAtEnd ("/")),
+      wasInitialisedWithWildcards (asString.containsAnyOf ("*?{}[]"))
+{
+    if (wasInitialisedWithWildcards)
+        OSCPatternCompiler::compile (oscSymbols, program);
+}
+
+//==============================================================================
+bool OSCAddressPattern::operator== (const OSCAddressPattern& other) const noexcept
+{
+    return asString == other.asString;
+}
+
+bool OSCAddressPattern::operator!= (const OSCAddressPattern& other) const noexcept
+{
+    return ! operator== (other);
+}
+
+//==============================================================================
+bool OSCAddressPattern::matches (const OSCAddress& address) const noexcept
+{
+    if (! containsWildcards())
+        return asString == address.asString;
+
+    return matches (address.asString.toRawUTF8(), address.asString.getNumBytesAsUTF8());
+}
+
+bool OSCAddressPattern::matches (const char* address, size_t maxBytes) const noexcept
+{
+    auto addressEnd = address + strnlen (address, maxBytes);
+
+    if (! containsWildcards())
+    {
+        // a plain address, compared like OSCAddress compares them: without the trailing slashes
+        while (addressEnd != address && addressEnd[-1] == '/')
+            --addressEnd;
+
+        auto size = (size_t) (addressEnd - address);
+        return size == asString.getNumBytesAsUTF8() && memcmp (address, asString.toRawUTF8(), size) == 0;
+    }
+
+    return OSCPatternCompiler::match (program.begin(), program.end(), address, addressEnd);
+}
+
+//==============================================================================
+String OSCAddressPattern::toString() const noexcept
+{
+    return asString;
+}
+
+//==============================================================================
+//==============================================================================
+#if JUCE_UNIT_TESTS
+
+namespace
+{
+    //==============================================================================
+    // The matcher that interpreted the pattern text on every call, kept as the
+    // reference for the compiled one
     template <typename CharPointerType>
     class OSCPatternMatcherImpl
     {
@@ -249,7 +731,7 @@ namespace
     };
 
     //==============================================================================
-    static bool matchOscPattern (const String& pattern, const String& target)
+    static bool interpretOscPattern (const String& pattern, const String& target)
     {
         return OSCPatternMatcherImpl<String::CharPointerType>::match (pattern.getCharPointer(),
                                                                       pattern.getCharPointer().findTerminatingNull(),
@@ -258,146 +740,16 @@ namespace
     }
 
     //==============================================================================
-    template <typename OSCAddressType> struct OSCAddressTokeniserTraits;
-    template <> struct OSCAddressTokeniserTraits<OSCAddress>        { static const char* getDisallowedChars() { return " #*,?/[]{}"; } };
-    template <> struct OSCAddressTokeniserTraits<OSCAddressPattern> { static const char* getDisallowedChars() { return " #/"; } };
-
-    //==============================================================================
-    template <typename OSCAddressType>
-    struct OSCAddressTokeniser
+    static bool matchOscPattern (const String& pattern, const String& target)
     {
-        using Traits = OSCAddressTokeniserTraits<OSCAddressType>;
-
-        //==============================================================================
-        static bool isPrintableASCIIChar (juce_wchar c) noexcept
-        {
-            return c >= ' ' && c <= '~';
-        }
-
-        static bool isDisallowedChar (juce_wchar c) noexcept
-        {
-            return CharPointer_ASCII (Traits::getDisallowedChars()).indexOf (c, false) >= 0;
-        }
-
-        static bool containsOnlyAllowedPrintableASCIIChars (const String& string) noexcept
-        {
-            for (auto charPtr = string.getCharPointer(); ! charPtr.isEmpty();)
-            {
-                auto c = charPtr.getAndAdvance();
+        Array<uint8> program;
+        OSCPatternCompiler::compilePart (pattern.toRawUTF8(), pattern.getNumBytesAsUTF8(), program);
 
-                if (! isPrintableASCIIChar (c) || isDisallowedChar (c))
-                    return false;
-            }
-
-            return true;
-        }
-
-        //==============================================================================
-        static StringArray tokenise (const String& address)
-        {
-            if (address.isEmpty())
-                throw OSCFormatError ("OSC format error: address string cannot be empty.");
-
-            if (! address.startsWithChar ('/'))
-                throw OSCFormatError ("OSC format error: address string must start with a forward slash.");
-
-            StringArray oscSymbols;
-            oscSymbols.addTokens (address, "/", StringRef());
-            oscSymbols.removeEmptyStrings (false);
-
-            for (auto& token : oscSymbols)
-                if (! containsOnlyAllowedPrintableASCIIChars (token))
-                    throw OSCFormatError ("OSC format error: encountered characters not allowed in address string.");
-
-            return oscSymbols;
-        }
-    };
-
-}  // namespace
-
-//==============================================================================
-OSCAddress::OSCAddress (const String& address)
-    : oscSymbols (OSCAddressTokeniser<OSCAddress>::tokenise (address)),
-      asString (address.trimCharactersAtEnd ("/"))
-{
-}
-
-OSCAddress::OSCAddress (const char* address)
-    : oscSymbols (OSCAddressTokeniser<OSCAddress>::tokenise (String (address))),
-      asString (String (address).trimCharactersAtEnd ("/"))
-{
-}
-
-//==============================================================================
-bool OSCAddress::operator== (const OSCAddress& other) const noexcept
-{
-    return asString == other.asString;
-}
-
-bool OSCAddress::operator!= (const OSCAddress& other) const noexcept
-{
-    return ! operator== (other);
-}
-
-//==============================================================================
-String OSCAddress::toString() const noexcept
-{
-    return asString;
-}
-
-//==============================================================================
-OSCAddressPattern::OSCAddressPattern (const String& address)
-    : oscSymbols (OSCAddressTokeniser<OSCAddressPattern>::tokenise (address)),
-      asString (address.trimCharactersAtEnd ("/")),
-      wasInitialisedWithWildcards (asString.containsAnyOf ("*?{}[]"))
-
-{
-}
-
-OSCAddressPattern::OSCAddressPattern (const char* address)
-    : oscSymbols (OSCAddressTokeniser<OSCAddressPattern>::tokenise (String (address))),
-      asString (String (address).trimCharactersAtEnd ("/")),
-      wasInitialisedWithWildcards (asString.containsAnyOf ("*?{}[]"))
-{
-}
-
-//==============================================================================
-bool OSCAddressPattern::operator== (const OSCAddressPattern& other) const noexcept
-{
-    return asString == other.asString;
-}
-
-bool OSCAddressPattern::operator!= (const OSCAddressPattern& other) const noexcept
-{
-    return ! operator== (other);
-}
-
-//==============================================================================
-bool OSCAddressPattern::matches (const OSCAddress& address) const noexcept
-{
-    if (! containsWildcards())
-        return asString == address.asString;
-
-    if (oscSymbols.size() != address.oscSymbols.size())
-        return false;
-
-    for (int i = 0; i < oscSymbols.size(); ++i)
-        if (! matchOscPattern (oscSymbols[i], address.oscSymbols[i]))
-            return false;
-
-    return true;
-}
-
-//==============================================================================
-String OSCAddressPattern::toString() const noexcept
-{
-    return asString;
+        auto targetBytes = target.toRawUTF8();
+        return OSCPatternCompiler::matchPart (program.begin() + 2, targetBytes, targetBytes + target.getNumBytesAsUTF8());
+    }
 }
 
-//==============================================================================
-//==============================================================================
-#if JUCE_UNIT_TESTS
-
 class OSCAddressTests : public UnitTest
 {
 public:
@@ -563,6 +915,26 @@ public:
             expect (! pattern.matches (OSCAddress ("/myotherpatch/output/slider9/position")));
         }
 
+        beginTest ("string matching raw address bytes");
+        {
+            OSCAddressPattern pattern ("/sl/*/{state,loop_pos}");
+            const char packet[] = "/sl/2/state\0,if";
+
+            expect (pattern.matches (packet, sizeof (packet)));
+            expect (pattern.matches ("/sl/2/loop_pos/", 15));
+            expect (pattern.matches ("//sl//2//state", 14));
+            expect (! pattern.matches ("/sl/2/state", 8));
+            expect (! pattern.matches ("/sl/2/rate", 10));
+            expect (! pattern.matches ("/sl/state", 9));
+            expect (OSCAddressPattern ("/").matches ("/", 1));
+            expect (OSCAddressPattern ("/ping").matches ("/ping", 5));
+            expect (! OSCAddressPattern ("/ping").matches ("/pong", 5));
+            expect (OSCAddressPattern ("/ping").matches ("/ping//", 7));
+            expect (! OSCAddressPattern ("/ping").matches ("/pin", 4));
+            expect (! OSCAddressPattern ("/ping").matches ("/ping/x", 7));
+            expect (! OSCAddressPattern ("/not{closing").matches ("/notclosing", 11));
+        }
+
         beginTest ("conversion to/from String");
         {
             {
@@ -775,6 +1147,60 @@ public:
         {
             expect (matchOscPattern ("*ea*ll[y-z0-9X-Zvwx]??m[o-q]l[e]x{fat,mat,pat}te{}r*?", "reallycomplexpattern"));
         }
+
+        beginTest ("compiled patterns match like the interpreter");
+        {
+            StringArray patterns { "", "*", "?", "*c", "c*", "f*o", "*[]", "*{}", "a*{,b}", "{}", "{,}", "{a,b,c}bcde",
+                                   "f{o,}o", "a{bc,de}fg{hij,klm}{n}{}", "not{closing", "not}opening", "{{nested}}",
+                                   "{a-c}bcde", "[]", "[!]", "[abcde]", "f[oo]", "[a-c-e]", "[z-a]", "foo[abc-]bar",
+                                   "foo[-]bar", "foo[!!]bar", "[!r-z]", "[[nested]]", "norangestar[-t]", "[a-]", "[a-",
+                                   "[!-]", "[a-{]", "n]otopening", "*ea*ll[y-z0-9X-Zvwx]??m[o-q]l[e]x{fat,mat,pat}te{}r*?" };
+            StringArray targets { "", "a", "b", "c", "e", "x", "z", "-", "!", "ab", "abc", "abcde", "bcdea", "fo", "foo",
+                                  "fuvwxyzo", "ccccbbbbaaaa", "adefghijn", "notclosing", "notopening", "nested",
+                                  "foobar", "foo-bar", "foo!bar", "fooxbar", "norangestart", "norangestar-",
+                                  "reallycomplexpattern" };
+
+            for (auto& pattern : patterns)
+                for (auto& target : targets)
+                    expect (matchOscPattern (pattern, target) == interpretOscPattern (pattern, target),
+                            "\"" + pattern + "\" against \"" + target + "\"");
+        }
+
+        beginTest ("compiled patterns against the interpreter, timing");
+        {
+            OSCAddressPattern pattern ("/sl/[0-9]*/{state,loop_pos,loop_len,cycle_len}");
+            const char* address = "/sl/12/loop_len";
+            const int iterations = 100000;
+
+            auto start = Time::getHighResolutionTicks();
+            int compiled = 0;
+
+            for (int i = 0; i < iterations; ++i)
+                compiled += pattern.matches (address, 16) ? 1 : 0;
+
+            auto middle = Time::getHighResolutionTicks();
+            int interpreted = 0;
+            StringArray symbols { "sl", "[0-9]*", "{state,loop_pos,loop_len,cycle_len}" };
+            StringArray addressSymbols { "sl", "12", "loop_len" };
+
+            for (int i = 0; i < iterations; ++i)
+            {
+                bool all = true;
+
+                for (int s = 0; s < symbols.size() && all; ++s)
+                    all = interpretOscPattern (symbols[s], addressSymbols[s]);
+
+                interpreted += all ? 1 : 0;
+            }
+
+            auto end = Time::getHighResolutionTicks();
+
+            expectEquals (compiled, iterations);
+            expectEquals (interpreted, iterations);
+            logMessage ("compiled: " + String (Time::highResolutionTicksToSeconds (middle - start) * 1.0e9 / iterations, 1)
+                         + " ns/match, interpreted: " + String (Time::highResolutionTicksToSeconds (end - middle) * 1.0e9 / iterations, 1)
+                         + " ns/match");
+        }
     }
 };
 
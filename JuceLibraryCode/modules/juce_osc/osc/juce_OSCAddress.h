@@ -129,6 +129,15 @@ public:
     */
     bool matches (const OSCAddress& address) const noexcept;
 
+    /** Checks if the OSCAddressPattern matches an OSC address given as raw bytes,
+        e.g. straight out of a received packet, with the same rules as above.
+
+        A pattern with wildcards is compiled when it is constructed and a plain
+        one is compared byte for byte, so this doesn't allocate.
+        The address isn't validated, and ends at maxBytes or its first null byte.
+    */
+    bool matches (const char* address, size_t maxBytes) const noexcept;
+
     /** Checks whether the OSCAddressPattern contains any of the allowed OSC
         address patttern wildcards: ?, *, [], {}
 
@@ -149,6 +158,7 @@ private:
     StringArray oscSymbols;
     String asString;
     bool wasInitialisedWithWildcards;
+    Array<uint8> program;   // the compiled pattern if it has wildcards, see OSCPatternCompiler
 };
 
 } // namespace juce
@@ -81,7 +81,7 @@ public:
     void setAddressPattern (const OSCAddressPattern& ap) noexcept;
 
     /** Returns the address pattern of the OSCMessage. */
-    OSCAddressPattern getAddressPattern() const noexcept;
+    const OSCAddressPattern& getAddressPattern() const noexcept;
 
     /** Returns the number of OSCArgument objects that belong to this OSCMessage. */
     int size() const noexcept;
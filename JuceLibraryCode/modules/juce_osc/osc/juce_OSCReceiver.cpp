@@ -313,9 +313,122 @@ namespace
             return message;
         }
     };
-
 } // namespace
 
+//==============================================================================
+/*  The listeners registered for an address, indexed by it.
+
+    A message without wildcards, which is nearly every one, finds its
+    listeners with one hash lookup of its address instead of matching it
+    against every registered address. Only a message whose pattern has
+    wildcards is still matched against all of them, with the pattern it
+    compiled when it was parsed.
+
+    A listener removed from within a callback is only nulled out, so that the
+    loop in call() doesn't skip the one after it, and the nulls are compacted
+    once the outermost call() returns.
+*/
+template <typename ListenerType>
+struct OSCListenersWithAddress
+{
+    void add (ListenerType* listenerToAdd, const OSCAddress& address)
+    {
+        for (auto& i : all)
+            if (address == i.first && listenerToAdd == i.second)
+                return;
+
+        all.add (std::make_pair (address, listenerToAdd));
+        byAddress[address.toString()].push_back (listenerToAdd);
+    }
+
+    void remove (ListenerType* listenerToRemove)
+    {
+        for (int i = 0; i < all.size(); ++i)
+        {
+            auto& entry = all.getReference (i);
+
+            if (listenerToRemove == entry.second)
+            {
+                // the map entry is kept, even when it's empty, in case call() is looking at it
+                auto& listeners = byAddress[entry.first.toString()];
+                auto found = std::find (listeners.begin(), listeners.end(), listenerToRemove);
+
+                if (callDepth > 0)
+                {
+                    *found = nullptr;
+                    entry.second = nullptr;
+                    ++numRemoved;
+                    break;
+                }
+
+                listeners.erase (found);
+
+                // aarrgh... can't simply call array.remove (i) because this
+                // requires a default c'tor to be present for OSCAddress...
+                // luckily, we don't care about methods preserving element order:
+                all.swap (i, all.size() - 1);
+                all.removeLast();
+                break;
+            }
+        }
+    }
+
+    void call (const OSCMessage& message)
+    {
+        auto& pattern = message.getAddressPattern();
+        ++callDepth;
+
+        if (! pattern.containsWildcards())
+        {
+            auto found = byAddress.find (pattern.toString());
+
+            if (found != byAddress.end())
+                for (size_t i = 0; i < found->second.size(); ++i)
+                    if (auto* listener = found->second[i])
+                        listener->oscMessageReceived (message);
+        }
+        else
+        {
+            for (int i = 0; i < all.size(); ++i)
+                if (auto* listener = all.getReference (i).second)
+                    if (pattern.matches (all.getReference (i).first))
+                        listener->oscMessageReceived (message);
+        }
+
+        if (--callDepth == 0 && numRemoved > 0)
+            compact();
+    }
+
+    int size() const noexcept      { return all.size() - numRemoved; }
+
+private:
+    void compact()
+    {
+        for (int i = all.size(); --i >= 0;)
+        {
+            if (all.getReference (i).second == nullptr)
+            {
+                all.swap (i, all.size() - 1);
+                all.removeLast();
+            }
+        }
+
+        for (auto& entry : byAddress)
+            entry.second.erase (std::remove (entry.second.begin(), entry.second.end(), nullptr), entry.second.end());
+
+        numRemoved = 0;
+    }
+
+    struct StringHash
+    {
+        size_t operator() (const String& s) const noexcept   { return (size_t) s.hashCode64(); }
+    };
+
+    Array<std::pair<OSCAddress, ListenerType*>> all;
+    std::unordered_map<String, std::vector<ListenerType*>, StringHash> byAddress;
+    int callDepth = 0, numRemoved = 0;
+};
+
 
 //==============================================================================
 struct OSCReceiver::Pimpl   : private Thread,
@@ -384,12 +497,12 @@ struct OSCReceiver::Pimpl   : private Thread,
     void addListener (ListenerWithOSCAddress<MessageLoopCallback>* listenerToAdd,
                       OSCAddress addressToMatch)
     {
-        addListenerWithAddress (listenerToAdd, addressToMatch, listenersWithAddress);
+        listenersWithAddress.add (listenerToAdd, addressToMatch);
     }
 
     void addListener (ListenerWithOSCAddress<RealtimeCallback>* listenerToAdd, OSCAddress addressToMatch)
     {
-        addListenerWithAddress (listenerToAdd, addressToMatch, realtimeListenersWithAddress);
+        realtimeListenersWithAddress.add (listenerToAdd, addressToMatch);
     }
 
     void removeListener (OSCReceiver::Listener<MessageLoopCallback>* listenerToRemove)
@@ -404,12 +517,12 @@ struct OSCReceiver::Pimpl   : private Thread,
 
     void removeListener (ListenerWithOSCAddress<MessageLoopCallback>* listenerToRemove)
     {
-        removeListenerWithAddress (listenerToRemove, listenersWithAddress);
+        listenersWithAddress.remove (listenerToRemove);
     }
 
     void removeListener (ListenerWithOSCAddress<RealtimeCallback>* listenerToRemove)
     {
-        removeListenerWithAddress (listenerToRemove, realtimeListenersWithAddress);
+        realtimeListenersWithAddress.remove (listenerToRemove);
     }
 
     //==============================================================================
@@ -424,6 +537,14 @@ struct OSCReceiver::Pimpl   : private Thread,
     //==============================================================================
     void handleBuffer (const char* data, size_t dataSize)
     {
+        JUCE_OSC_TRACE_SCOPE ("OSCReceiver::handleBuffer");
+
+        if (packetHandler != nullptr)
+            packetHandler (data, (int) dataSize);
+
+        if (packetFilter != nullptr && packetFilter (data, (int) dataSize))
+            return;
+
         OSCInputStream inStream (data, dataSize);
 
         try
@@ -435,7 +556,7 @@ struct OSCReceiver::Pimpl   : private Thread,
             callRealtimeListeners (content);
 
             if (content.isMessage())
-                callRealtimeListenersWithAddress (content.getMessage());
+                realtimeListenersWithAddress.call (content.getMessage());
 
             // now post the message that will trigger the handleMessage callback
             // dealing with the non-realtime listeners.
@@ -455,6 +576,18 @@ struct OSCReceiver::Pimpl   : private Thread,
         formatErrorHandler = handler;
     }
 
+    void registerPacketHandler (OSCReceiver::PacketHandler handler)
+    {
+        jassert (! isThreadRunning()); // the network thread reads this without a lock
+        packetHandler = handler;
+    }
+
+    void registerPacketFilter (OSCReceiver::PacketFilter filter)
+    {
+        jassert (! isThreadRunning()); // the network thread reads this without a lock
+        packetFilter = filter;
+    }
+
 private:
     //==============================================================================
     void run() override
@@ -475,41 +608,11 @@ private:
         }
     }
 
-    //==============================================================================
-    template <typename ListenerType>
-    void addListenerWithAddress (ListenerType* listenerToAdd,
-                                 OSCAddress address,
-                                 Array<std::pair<OSCAddress, ListenerType*>>& array)
-    {
-        for (auto& i : array)
-            if (address == i.first && listenerToAdd == i.second)
-                return;
-
-        array.add (std::make_pair (address, listenerToAdd));
-    }
-
-    //==============================================================================
-    template <typename ListenerType>
-    void removeListenerWithAddress (ListenerType* listenerToRemove,
-                                    Array<std::pair<OSCAddress, ListenerType*>>& array)
-    {
-        for (int i = 0; i < array.size(); ++i)
-        {
-            if (listenerToRemove == array.getReference (i).second)
-            {
-                // aarrgh... can't simply call array.remove (i) because this
-                // requires a default c'tor to be present for OSCAddress...
-                // luckily, we don't care about methods preserving element order:
-                array.swap (i, array.size() - 1);
-                array.removeLast();
-                break;
-            }
-        }
-    }
-
     //==============================================================================
     void handleMessage (const Message& msg) override
     {
+        JUCE_OSC_TRACE_SCOPE ("OSCReceiver::handleMessage");
+
         if (auto* callbackMessage = dynamic_cast<const CallbackMessage*> (&msg))
         {
             auto& content = callbackMessage->content;
@@ -517,7 +620,7 @@ private:
             callListeners (content);
 
             if (content.isMessage())
-                callListenersWithAddress (content.getMessage());
+                listenersWithAddress.call (content.getMessage());
         }
     }
 
@@ -540,6 +643,7 @@ private:
 
     void callRealtimeListeners (const OSCBundle::Element& content)
     {
+        JUCE_OSC_TRACE_SCOPE ("OSCReceiver realtime listeners");
         using Listener = OSCReceiver::Listener<OSCReceiver::RealtimeCallback>;
 
         if (content.isMessage())
@@ -554,32 +658,17 @@ private:
         }
     }
 
-    //==============================================================================
-    void callListenersWithAddress (const OSCMessage& message)
-    {
-        for (auto& entry : listenersWithAddress)
-            if (auto* listener = entry.second)
-                if (message.getAddressPattern().matches (entry.first))
-                    listener->oscMessageReceived (message);
-    }
-
-    void callRealtimeListenersWithAddress (const OSCMessage& message)
-    {
-        for (auto& entry : realtimeListenersWithAddress)
-            if (auto* listener = entry.second)
-                if (message.getAddressPattern().matches (entry.first))
-                    listener->oscMessageReceived (message);
-    }
-
     //==============================================================================
     ListenerList<OSCReceiver::Listener<OSCReceiver::MessageLoopCallback>> listeners;
     ListenerList<OSCReceiver::Listener<OSCReceiver::RealtimeCallback>>    realtimeListeners;
 
-    Array<std::pair<OSCAddress, OSCReceiver::ListenerWithOSCAddress<OSCReceiver::MessageLoopCallback>*>> listenersWithAddress;
-    Array<std::pair<OSCAddress, OSCReceiver::ListenerWithOSCAddress<OSCReceiver::RealtimeCallback>*>>    realtimeListenersWithAddress;
+    OSCListenersWithAddress<OSCReceiver::ListenerWithOSCAddress<OSCReceiver::MessageLoopCallback>> listenersWithAddress;
+    OSCListenersWithAddress<OSCReceiver::ListenerWithOSCAddress<OSCReceiver::RealtimeCallback>>    realtimeListenersWithAddress;
 
     OptionalScopedPointer<DatagramSocket> socket;
     OSCReceiver::FormatErrorHandler formatErrorHandler { nullptr };
+    OSCReceiver::PacketHandler packetHandler { nullptr };
+    OSCReceiver::PacketFilter packetFilter { nullptr };
     enum { oscBufferSize = 4098 };
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Pimpl)
@@ -659,6 +748,16 @@ void OSCReceiver::registerFormatErrorHandler (FormatErrorHandler handler)
     pimpl->registerFormatErrorHandler (handler);
 }
 
+void OSCReceiver::registerPacketHandler (PacketHandler handler)
+{
+    pimpl->registerPacketHandler (handler);
+}
+
+void OSCReceiver::registerPacketFilter (PacketFilter filter)
+{
+    pimpl->registerPacketFilter (filter);
+}
+
 
 //==============================================================================
 //==============================================================================
@@ -1187,6 +1286,110 @@ public:
 
 static OSCInputStreamTests OSCInputStreamUnitTests;
 
+//==============================================================================
+class OSCListenerRoutingTests  : public UnitTest
+{
+public:
+    OSCListenerRoutingTests() : UnitTest ("OSCReceiver class / listener routing", "OSC") {}
+
+    struct CountingListener  : public OSCReceiver::ListenerWithOSCAddress<OSCReceiver::RealtimeCallback>
+    {
+        void oscMessageReceived (const OSCMessage&) override    { ++count; }
+        int count = 0;
+    };
+
+    void runTest()
+    {
+        OSCListenersWithAddress<OSCReceiver::ListenerWithOSCAddress<OSCReceiver::RealtimeCallback>> routing;
+        CountingListener state0, state1, pos1, twice;
+
+        routing.add (&state0, OSCAddress ("/sl/0/state"));
+        routing.add (&state1, OSCAddress ("/sl/1/state"));
+        routing.add (&pos1, OSCAddress ("/sl/1/loop_pos"));
+        routing.add (&twice, OSCAddress ("/sl/1/state"));
+        routing.add (&twice, OSCAddress ("/sl/1/state"));
+
+        beginTest ("exact addresses");
+        {
+            expectEquals (routing.size(), 4);
+
+            routing.call (OSCMessage ("/sl/1/state"));
+            routing.call (OSCMessage ("/sl/1/state/"));
+            routing.call (OSCMessage ("/sl/2/state"));
+
+            expectEquals (state0.count, 0);
+            expectEquals (state1.count, 2);
+            expectEquals (pos1.count, 0);
+            expectEquals (twice.count, 2);
+        }
+
+        beginTest ("wildcard patterns");
+        {
+            routing.call (OSCMessage ("/sl/*/state"));
+            routing.call (OSCMessage ("/sl/1/{state,loop_pos}"));
+
+            expectEquals (state0.count, 1);
+            expectEquals (state1.count, 4);
+            expectEquals (pos1.count, 1);
+            expectEquals (twice.count, 4);
+        }
+
+        beginTest ("removing listeners");
+        {
+            routing.remove (&state1);
+            routing.call (OSCMessage ("/sl/1/state"));
+            routing.call (OSCMessage ("/sl/?/state"));
+
+            expectEquals (routing.size(), 3);
+            expectEquals (state0.count, 2);
+            expectEquals (state1.count, 4);
+            expectEquals (twice.count, 6);
+        }
+
+        beginTest ("removing listeners from within their callback");
+        {
+            using Routing = OSCListenersWithAddress<OSCReceiver::ListenerWithOSCAddress<OSCReceiver::RealtimeCallback>>;
+
+            struct RemovingListener  : public CountingListener
+            {
+                RemovingListener (Routing& r)  : routing (r) {}
+
+                void oscMessageReceived (const OSCMessage&) override
+                {
+                    ++count;
+                    routing.remove (this);
+                }
+
+                Routing& routing;
+            };
+
+            for (auto* address : { "/sl/0/rate", "/sl/?/rate" })
+            {
+                Routing removing;
+                RemovingListener first (removing), second (removing);
+                CountingListener third;
+
+                removing.add (&first, OSCAddress ("/sl/0/rate"));
+                removing.add (&second, OSCAddress ("/sl/0/rate"));
+                removing.add (&third, OSCAddress ("/sl/0/rate"));
+
+                removing.call (OSCMessage (address));
+                expectEquals (first.count, 1);
+                expectEquals (second.count, 1);
+                expectEquals (third.count, 1);
+                expectEquals (removing.size(), 1);
+
+                removing.call (OSCMessage (address));
+                expectEquals (first.count, 1);
+                expectEquals (second.count, 1);
+                expectEquals (third.count, 2);
+            }
+        }
+    }
+};
+
+static OSCListenerRoutingTests OSCListenerRoutingUnitTests;
+
 #endif // JUCE_UNIT_TESTS
 
 } // namespace juce
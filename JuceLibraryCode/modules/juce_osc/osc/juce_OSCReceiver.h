@@ -213,6 +213,35 @@ public:
     */
     void registerFormatErrorHandler (FormatErrorHandler handler);
 
+    //==============================================================================
+    /** A function that is called with every raw packet the OSCReceiver receives.
+
+        The arguments passed are the pointer to and the size of the datagram, the
+        data is only valid for the duration of the call.
+    */
+    using PacketHandler = std::function<void (const char* data, int dataSize)>;
+
+    /** Installs a function which is called on the network thread with every
+        packet received, before it is parsed and passed on to the listeners.
+
+        This can be used to log or capture the incoming OSC traffic. Call it
+        before connect(), the network thread reads it without locking.
+    */
+    void registerPacketHandler (PacketHandler handler);
+
+    /** A function that can handle a raw packet itself, see registerPacketFilter(). */
+    using PacketFilter = std::function<bool (const char* data, int dataSize)>;
+
+    /** Installs a function which is called on the network thread with every
+        packet received, after the packet handler.
+
+        If it returns true the packet was dealt with, and is neither parsed
+        nor passed on to any listeners. This lets frequent messages be decoded
+        in place, without the allocations of building an OSCMessage. Like the
+        packet handler, it must be installed before connect().
+    */
+    void registerPacketFilter (PacketFilter filter);
+
 private:
     //==============================================================================
     struct Pimpl;
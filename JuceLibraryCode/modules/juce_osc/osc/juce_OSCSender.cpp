@@ -27,180 +27,316 @@
 namespace juce
 {
 
-namespace
-{
-    //==============================================================================
-    /** Writes OSC data to an internal memory buffer, which grows as required.
+//==============================================================================
+/** The bytes an OSCOutputStream has written, in a MemoryBlock that grows as
+    required or in a fixed size buffer that the caller owns.
 
-        The data that was written into the stream can then be accessed later as
-        a contiguous block of memory.
+    This has the few writes of a MemoryOutputStream that OSC needs. It isn't an
+    OutputStream, whose constructor makes a new-line String and so allocates,
+    which would make every encode into caller storage allocate too.
+*/
+struct OSCOutputBuffer
+{
+    OSCOutputBuffer() noexcept {}
 
-        This class implements the Open Sound Control 1.0 Specification for
-        the format in which the OSC data will be written into the buffer.
-    */
-    struct OSCOutputStream
+    OSCOutputBuffer (void* destBuffer, size_t destBufferSize) noexcept
+        : externalData (static_cast<char*> (destBuffer)), availableSize (destBufferSize)
     {
-        OSCOutputStream() noexcept {}
+        jassert (externalData != nullptr); // This must be a valid pointer.
+    }
 
-        /** Returns a pointer to the data that has been written to the stream. */
-        const void* getData() const noexcept    { return output.getData(); }
+    void reset() noexcept                   { position = size = 0; }
+    const void* getData() const noexcept    { return externalData != nullptr ? externalData : block.getData(); }
+    size_t getDataSize() const noexcept     { return size; }
+    int64 getPosition() const noexcept      { return (int64) position; }
 
-        /** Returns the number of bytes of data that have been written to the stream. */
-        size_t getDataSize() const noexcept     { return output.getDataSize(); }
+    bool setPosition (int64 newPosition) noexcept
+    {
+        if (newPosition < 0 || newPosition > (int64) size)
+            return false;
 
-        //==============================================================================
-        bool writeInt32 (int32 value)
-        {
-            return output.writeIntBigEndian (value);
-        }
+        position = (size_t) newPosition;
+        return true;
+    }
 
-        bool writeUint64 (uint64 value)
+    //==============================================================================
+    bool write (const void* data, size_t numBytes)
+    {
+        if (auto* dest = prepareToWrite (numBytes))
         {
-            return output.writeInt64BigEndian (int64 (value));
+            memcpy (dest, data, numBytes);
+            return true;
         }
 
-        bool writeFloat32 (float value)
+        return numBytes == 0;
+    }
+
+    bool writeRepeatedByte (uint8 byte, size_t numBytes)
+    {
+        if (auto* dest = prepareToWrite (numBytes))
         {
-            return output.writeFloatBigEndian (value);
+            memset (dest, byte, numBytes);
+            return true;
         }
 
-        bool writeString (const String& value)
-        {
-            if (! output.writeString (value))
-                return false;
+        return numBytes == 0;
+    }
 
-            const size_t numPaddingZeros = ~value.length() & 3;
+    bool writeByte (char byte)                  { return write (&byte, 1); }
+    bool writeString (const String& text)       { return write (text.toRawUTF8(), text.getNumBytesAsUTF8() + 1); }
 
-            return output.writeRepeatedByte ('\0', numPaddingZeros);
-        }
+    bool writeIntBigEndian (int value)
+    {
+        auto v = ByteOrder::swapIfLittleEndian ((uint32) value);
+        return write (&v, 4);
+    }
 
-        bool writeBlob (const MemoryBlock& blob)
-        {
-            if (! (output.writeIntBigEndian ((int) blob.getSize())
-                    && output.write (blob.getData(), blob.getSize())))
-                return false;
+    bool writeInt64BigEndian (int64 value)
+    {
+        auto v = ByteOrder::swapIfLittleEndian ((uint64) value);
+        return write (&v, 8);
+    }
 
-            const size_t numPaddingZeros = ~(blob.getSize() - 1) & 3;
+    bool writeFloatBigEndian (float value)
+    {
+        union { int asInt; float asFloat; } n;
+        n.asFloat = value;
+        return writeIntBigEndian (n.asInt);
+    }
 
-            return output.writeRepeatedByte (0, numPaddingZeros);
-        }
+private:
+    char* prepareToWrite (size_t numBytes)
+    {
+        if (numBytes == 0)
+            return nullptr;
 
-        bool writeTimeTag (OSCTimeTag timeTag)
-        {
-            return output.writeInt64BigEndian (int64 (timeTag.getRawTimeTag()));
-        }
+        auto storageNeeded = position + numBytes;
+        char* data;
 
-        bool writeAddress (const OSCAddress& address)
+        if (externalData == nullptr)
         {
-            return writeString (address.toString());
-        }
+            if (storageNeeded > block.getSize())
+                block.ensureSize ((storageNeeded + storageNeeded / 2 + 32) & ~(size_t) 31);
 
-        bool writeAddressPattern (const OSCAddressPattern& ap)
+            data = static_cast<char*> (block.getData());
+        }
+        else
         {
-            return writeString (ap.toString());
+            if (storageNeeded > availableSize)
+                return nullptr;
+
+            data = externalData;
         }
 
-        bool writeTypeTagString (const OSCTypeList& typeList)
-        {
-            output.writeByte (',');
+        auto* writePointer = data + position;
+        position = storageNeeded;
+        size = jmax (size, position);
+        return writePointer;
+    }
+
+    MemoryBlock block;
+    char* externalData = nullptr;
+    size_t availableSize = 0, position = 0, size = 0;
+};
 
-            if (typeList.size() > 0)
-                output.write (typeList.begin(), (size_t) typeList.size());
+//==============================================================================
+/** Writes OSC data to an internal memory buffer, which grows as required,
+    or to a fixed size buffer that the caller owns.
 
-            output.writeByte ('\0');
+    The data that was written into the stream can then be accessed later as
+    a contiguous block of memory.
 
-            size_t bytesWritten = (size_t) typeList.size() + 1;
-            size_t numPaddingZeros = ~bytesWritten & 0x03;
+    This class implements the Open Sound Control 1.0 Specification for
+    the format in which the OSC data will be written into the buffer.
+*/
+struct OSCOutputStream
+{
+    OSCOutputStream() noexcept {}
 
-            return output.writeRepeatedByte ('\0', numPaddingZeros);
-        }
+    /** Writes into destBuffer, which is never resized: the writes that don't
+        fit into it fail.
+    */
+    OSCOutputStream (void* destBuffer, size_t destBufferSize)
+        : output (destBuffer, destBufferSize)
+    {
+    }
 
-        bool writeArgument (const OSCArgument& arg)
-        {
-            switch (arg.getType())
-            {
-                case OSCTypes::int32:       return writeInt32 (arg.getInt32());
-                case OSCTypes::float32:     return writeFloat32 (arg.getFloat32());
-                case OSCTypes::string:      return writeString (arg.getString());
-                case OSCTypes::blob:        return writeBlob (arg.getBlob());
-
-                default:
-                    // In this very unlikely case you supplied an invalid OSCType!
-                    jassertfalse;
-                    return false;
-            }
-        }
+    /** Empties the stream, keeping its memory for the next packet. */
+    void reset() noexcept                   { output.reset(); }
 
-        //==============================================================================
-        bool writeMessage (const OSCMessage& msg)
-        {
-            if (! writeAddressPattern (msg.getAddressPattern()))
-                return false;
+    /** Returns a pointer to the data that has been written to the stream. */
+    const void* getData() const noexcept    { return output.getData(); }
 
-            OSCTypeList typeList;
+    /** Returns the number of bytes of data that have been written to the stream. */
+    size_t getDataSize() const noexcept     { return output.getDataSize(); }
 
-            for (auto& arg : msg)
-                typeList.add (arg.getType());
+    //==============================================================================
+    bool writeInt32 (int32 value)
+    {
+        return output.writeIntBigEndian (value);
+    }
 
-            if (! writeTypeTagString (typeList))
+    bool writeUint64 (uint64 value)
+    {
+        return output.writeInt64BigEndian (int64 (value));
+    }
+
+    bool writeFloat32 (float value)
+    {
+        return output.writeFloatBigEndian (value);
+    }
+
+    bool writeString (const String& value)
+    {
+        if (! output.writeString (value))
+            return false;
+
+        const size_t numPaddingZeros = ~value.length() & 3;
+
+        return output.writeRepeatedByte ('\0', numPaddingZeros);
+    }
+
+    bool writeBlob (const MemoryBlock& blob)
+    {
+        if (! (output.writeIntBigEndian ((int) blob.getSize())
+                && output.write (blob.getData(), blob.getSize())))
+            return false;
+
+        const size_t numPaddingZeros = ~(blob.getSize() - 1) & 3;
+
+        return output.writeRepeatedByte (0, numPaddingZeros);
+    }
+
+    bool writeTimeTag (OSCTimeTag timeTag)
+    {
+        return output.writeInt64BigEndian (int64 (timeTag.getRawTimeTag()));
+    }
+
+    bool writeAddress (const OSCAddress& address)
+    {
+        return writeString (address.toString());
+    }
+
+    bool writeAddressPattern (const OSCAddressPattern& ap)
+    {
+        return writeString (ap.toString());
+    }
+
+    bool writeTypeTagString (const OSCTypeList& typeList)
+    {
+        output.writeByte (',');
+
+        if (typeList.size() > 0)
+            output.write (typeList.begin(), (size_t) typeList.size());
+
+        output.writeByte ('\0');
+
+        size_t bytesWritten = (size_t) typeList.size() + 1;
+        size_t numPaddingZeros = ~bytesWritten & 0x03;
+
+        return output.writeRepeatedByte ('\0', numPaddingZeros);
+    }
+
+    /** Writes the message's type tag string straight from its arguments,
+        without collecting them into an OSCTypeList first.
+    */
+    bool writeTypeTagString (const OSCMessage& msg)
+    {
+        if (! output.writeByte (','))
+            return false;
+
+        for (auto& arg : msg)
+            if (! output.writeByte (arg.getType()))
                 return false;
 
-            for (auto& arg : msg)
-                if (! writeArgument (arg))
-                    return false;
+        if (! output.writeByte ('\0'))
+            return false;
 
-            return true;
-        }
+        size_t bytesWritten = (size_t) msg.size() + 1;
+        size_t numPaddingZeros = ~bytesWritten & 0x03;
+
+        return output.writeRepeatedByte ('\0', numPaddingZeros);
+    }
 
-        bool writeBundle (const OSCBundle& bundle)
+    bool writeArgument (const OSCArgument& arg)
+    {
+        switch (arg.getType())
         {
-            if (! writeString ("#bundle"))
+            case OSCTypes::int32:       return writeInt32 (arg.getInt32());
+            case OSCTypes::float32:     return writeFloat32 (arg.getFloat32());
+            case OSCTypes::string:      return writeString (arg.getString());
+            case OSCTypes::blob:        return writeBlob (arg.getBlob());
+
+            default:
+                // In this very unlikely case you supplied an invalid OSCType!
+                jassertfalse;
                 return false;
+        }
+    }
 
-            if (! writeTimeTag (bundle.getTimeTag()))
+    //==============================================================================
+    bool writeMessage (const OSCMessage& msg)
+    {
+        if (! writeAddressPattern (msg.getAddressPattern()))
+            return false;
+
+        if (! writeTypeTagString (msg))
+            return false;
+
+        for (auto& arg : msg)
+            if (! writeArgument (arg))
                 return false;
 
-            for (auto& element : bundle)
-                if (! writeBundleElement (element))
-                    return false;
+        return true;
+    }
 
-            return true;
-        }
+    bool writeBundle (const OSCBundle& bundle)
+    {
+        if (! writeString ("#bundle"))
+            return false;
 
-        //==============================================================================
-        bool writeBundleElement (const OSCBundle::Element& element)
-        {
-            const int64 startPos = output.getPosition();
+        if (! writeTimeTag (bundle.getTimeTag()))
+            return false;
 
-            if (! writeInt32 (0))   // writing dummy value for element size
+        for (auto& element : bundle)
+            if (! writeBundleElement (element))
                 return false;
 
-            if (element.isBundle())
-            {
-                if (! writeBundle (element.getBundle()))
-                    return false;
-            }
-            else
-            {
-                if (! writeMessage (element.getMessage()))
-                    return false;
-            }
+        return true;
+    }
 
-            const int64 endPos = output.getPosition();
-            const int64 elementSize = endPos - (startPos + 4);
+    //==============================================================================
+    bool writeBundleElement (const OSCBundle::Element& element)
+    {
+        const int64 startPos = output.getPosition();
 
-            return output.setPosition (startPos)
-                     && writeInt32 ((int32) elementSize)
-                     && output.setPosition (endPos);
+        if (! writeInt32 (0))   // writing dummy value for element size
+            return false;
+
+        if (element.isBundle())
+        {
+            if (! writeBundle (element.getBundle()))
+                return false;
+        }
+        else
+        {
+            if (! writeMessage (element.getMessage()))
+                return false;
         }
 
-    private:
-        MemoryOutputStream output;
+        const int64 endPos = output.getPosition();
+        const int64 elementSize = endPos - (startPos + 4);
 
-        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OSCOutputStream)
-    };
+        return output.setPosition (startPos)
+                 && writeInt32 ((int32) elementSize)
+                 && output.setPosition (endPos);
+    }
 
-} // namespace
+private:
+    OSCOutputBuffer output;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OSCOutputStream)
+};
 
 
 //==============================================================================
@@ -212,6 +348,8 @@ struct OSCSender::Pimpl
     //==============================================================================
     bool connect (const String& newTargetHost, int newTargetPort)
     {
+        const ScopedLock sl (sendLock);
+
         if (! disconnect())
             return false;
 
@@ -228,6 +366,8 @@ struct OSCSender::Pimpl
 
     bool connectToSocket (DatagramSocket& newSocket, const String& newTargetHost, int newTargetPort)
     {
+        const ScopedLock sl (sendLock);
+
         if (! disconnect())
             return false;
 
@@ -239,6 +379,7 @@ struct OSCSender::Pimpl
 
     bool disconnect()
     {
+        const ScopedLock sl (sendLock);
         socket.reset();
         return true;
     }
@@ -246,33 +387,53 @@ struct OSCSender::Pimpl
     //==============================================================================
     bool send (const OSCMessage& message, const String& hostName, int portNumber)
     {
-        OSCOutputStream outStream;
+        JUCE_OSC_TRACE_SCOPE ("OSCSender::send");
+        const ScopedLock sl (sendLock);
+        outStream.reset();
 
         return outStream.writeMessage (message)
-            && sendOutputStream (outStream, hostName, portNumber);
+            && sendData (outStream.getData(), outStream.getDataSize(), hostName, portNumber);
     }
 
     bool send (const OSCBundle& bundle, const String& hostName, int portNumber)
     {
-        OSCOutputStream outStream;
+        JUCE_OSC_TRACE_SCOPE ("OSCSender::send bundle");
+        const ScopedLock sl (sendLock);
+        outStream.reset();
 
         return outStream.writeBundle (bundle)
-            && sendOutputStream (outStream, hostName, portNumber);
+            && sendData (outStream.getData(), outStream.getDataSize(), hostName, portNumber);
     }
 
     bool send (const OSCMessage& message)   { return send (message, targetHostName, targetPortNumber); }
     bool send (const OSCBundle& bundle)     { return send (bundle,  targetHostName, targetPortNumber); }
 
+    bool sendPacket (const void* data, size_t dataSize)
+    {
+        JUCE_OSC_TRACE_SCOPE ("OSCSender::sendPacket");
+        const ScopedLock sl (sendLock);
+        return sendData (data, dataSize, targetHostName, targetPortNumber);
+    }
+
+    //==============================================================================
+    void registerPacketHandler (OSCSender::PacketHandler handler)
+    {
+        packetHandler = handler;
+    }
+
 private:
     //==============================================================================
-    bool sendOutputStream (OSCOutputStream& outStream, const String& hostName, int portNumber)
+    bool sendData (const void* data, size_t dataSize, const String& hostName, int portNumber)
     {
         if (socket != nullptr)
         {
-            const int streamSize = (int) outStream.getDataSize();
+            const int streamSize = (int) dataSize;
 
-            const int bytesWritten = socket->write (hostName, portNumber,
-                                                    outStream.getData(), streamSize);
+            if (packetHandler != nullptr)
+                packetHandler (static_cast<const char*> (data), streamSize);
+
+            JUCE_OSC_TRACE_SCOPE ("OSCSender socket write");
+            const int bytesWritten = socket->write (hostName, portNumber, data, streamSize);
             return bytesWritten == streamSize;
         }
 
@@ -287,6 +448,13 @@ private:
     OptionalScopedPointer<DatagramSocket> socket;
     String targetHostName;
     int targetPortNumber = 0;
+    OSCSender::PacketHandler packetHandler { nullptr };
+
+    // reused for every message, so that its buffer is only grown once
+    OSCOutputStream outStream;
+
+    // a sender may be reconnected while another thread is sending through it
+    CriticalSection sendLock;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Pimpl)
 };
@@ -326,6 +494,26 @@ bool OSCSender::send (const OSCBundle& bundle)      { return pimpl->send (bundle
 bool OSCSender::sendToIPAddress (const String& host, int port, const OSCMessage& message) { return pimpl->send (message, host, port); }
 bool OSCSender::sendToIPAddress (const String& host, int port, const OSCBundle& bundle)   { return pimpl->send (bundle,  host, port); }
 
+bool OSCSender::sendPacket (const void* data, size_t dataSize)  { return pimpl->sendPacket (data, dataSize); }
+
+//==============================================================================
+size_t OSCSender::encode (const OSCMessage& message, void* destBuffer, size_t destBufferSize)
+{
+    OSCOutputStream outStream (destBuffer, destBufferSize);
+    return outStream.writeMessage (message) ? outStream.getDataSize() : 0;
+}
+
+size_t OSCSender::encode (const OSCBundle& bundle, void* destBuffer, size_t destBufferSize)
+{
+    OSCOutputStream outStream (destBuffer, destBufferSize);
+    return outStream.writeBundle (bundle) ? outStream.getDataSize() : 0;
+}
+
+void OSCSender::registerPacketHandler (PacketHandler handler)
+{
+    pimpl->registerPacketHandler (handler);
+}
+
 //==============================================================================
 //==============================================================================
 #if JUCE_UNIT_TESTS
@@ -651,6 +839,33 @@ public:
                 expect (std::memcmp (outStream.getData(), check, sizeof (check)) == 0);
             }
         }
+
+        beginTest ("Encoding into caller storage.");
+        {
+            OSCMessage msg ("/sl/-3/hit");
+            msg.addString ("record");
+            msg.addInt32 (1);
+
+            OSCOutputStream outStream;
+            expect (outStream.writeMessage (msg));
+
+            uint8 buffer[64];
+            expectEquals ((int) OSCSender::encode (msg, buffer, sizeof (buffer)), (int) outStream.getDataSize());
+            expect (std::memcmp (buffer, outStream.getData(), outStream.getDataSize()) == 0);
+
+            expectEquals ((int) OSCSender::encode (msg, buffer, outStream.getDataSize()), (int) outStream.getDataSize());
+            expectEquals ((int) OSCSender::encode (msg, buffer, outStream.getDataSize() - 1), 0);
+
+            OSCBundle bundle;
+            bundle.addElement (msg);
+            bundle.addElement (OSCMessage ("/ping"));
+
+            OSCOutputStream bundleStream;
+            expect (bundleStream.writeBundle (bundle));
+            expectEquals ((int) OSCSender::encode (bundle, buffer, sizeof (buffer)), (int) bundleStream.getDataSize());
+            expect (std::memcmp (buffer, bundleStream.getData(), bundleStream.getDataSize()) == 0);
+            expectEquals ((int) OSCSender::encode (bundle, buffer, 16), 0);
+        }
     }
 };
 
@@ -115,6 +115,35 @@ public:
     bool sendToIPAddress (const String& targetIPAddress, int targetPortNumber,
                           const OSCBundle& bundle);
 
+    /** Sends an already encoded OSC packet to the target as it is.
+
+        This doesn't allocate, so it can be used on paths that mustn't, with
+        the packet encoded into memory the caller owns.
+        @param  data      The encoded message or bundle.
+        @param  dataSize  Its size in bytes.
+        @returns true if the operation was successful.
+    */
+    bool sendPacket (const void* data, size_t dataSize);
+
+    //==============================================================================
+    /** Encodes an OSC message into memory the caller owns, e.g. on the stack,
+        without allocating.
+
+        Together with sendPacket() this lets a message be encoded once and sent
+        many times, or encoded on one thread and sent from another.
+        @param  message         The OSC message to encode.
+        @param  destBuffer      Where to write the encoded packet.
+        @param  destBufferSize  The size of destBuffer in bytes.
+        @returns the size of the encoded packet, or 0 if it didn't fit.
+    */
+    static size_t encode (const OSCMessage& message, void* destBuffer, size_t destBufferSize);
+
+    /** Encodes an OSC bundle into memory the caller owns, without allocating.
+        @returns the size of the encoded packet, or 0 if it didn't fit.
+        @see encode (const OSCMessage&, void*, size_t)
+    */
+    static size_t encode (const OSCBundle& bundle, void* destBuffer, size_t destBufferSize);
+
     /** Creates a new OSC message with the specified address pattern and list
         of arguments, and sends it to the target.
 
@@ -138,6 +167,21 @@ public:
     bool sendToIPAddress (const String& targetIPAddress, int targetPortNumber,
                           const OSCAddressPattern& address, Args&&... args);
 
+    //==============================================================================
+    /** A function that is called with every encoded packet the OSCSender sends.
+
+        The arguments passed are the pointer to and the size of the packet, the
+        data is only valid for the duration of the call.
+    */
+    using PacketHandler = std::function<void (const char* data, int dataSize)>;
+
+    /** Installs a function which is called on the sending thread with every
+        packet, just before it is written to the socket.
+
+        This can be used to log or capture the outgoing OSC traffic.
+    */
+    void registerPacketHandler (PacketHandler handler);
+
 private:
     //==============================================================================
     struct Pimpl;
@@ -0,0 +1,181 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ ==============================================================================
+ Counts heap allocations on the controller's hot paths, compiled in with
+ -DLOOP4R_ALLOC_GUARD=1 (e.g. make CPPFLAGS=-DLOOP4R_ALLOC_GUARD=1).
+ Otherwise LOOP4R_ALLOC_GUARD_SCOPE expands to nothing.
+
+ This replaces the global operator new and delete, so only Main.cpp may
+ include it. Each LOOP4R_ALLOC_GUARD_SCOPE is one event site: while the guard
+ is armed, the allocations its thread makes inside the scope are counted
+ against the site. The first few events of a site are its warm-up, where
+ buffers and caches are still being sized; any allocation after that is a
+ steady state allocation, and report() fails.
+ ==============================================================================
+ */
+
+#ifndef LOOP4R_ALLOC_GUARD
+ #define LOOP4R_ALLOC_GUARD 0
+#endif
+
+#if LOOP4R_ALLOC_GUARD
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace loop4rAlloc
+{
+    static const int64_t warmupEvents = 8;
+    static const int maxSites = 32;
+
+    struct Site
+    {
+        explicit Site(const char* name);
+
+        const char* name_;
+        std::atomic<int64_t> events_ { 0 };
+        std::atomic<int64_t> allocatingEvents_ { 0 };
+        std::atomic<int64_t> allocations_ { 0 };
+    };
+
+    struct Registry
+    {
+        std::atomic<bool> armed_ { false };
+        std::atomic<int> siteCount_ { 0 };
+        Site* sites_[maxSites];
+    };
+
+    inline Registry& registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    inline uint64_t& threadAllocations()
+    {
+        thread_local uint64_t count = 0;
+        return count;
+    }
+
+    inline Site::Site(const char* name) : name_(name)
+    {
+        Registry& all = registry();
+        int index = all.siteCount_.fetch_add(1);
+        if (index < maxSites)
+        {
+            all.sites_[index] = this;
+        }
+    }
+
+    // counting only starts once armed, e.g. for the length of a replay
+    inline void arm(bool armed)
+    {
+        registry().armed_.store(armed);
+    }
+
+    struct Scope
+    {
+        explicit Scope(Site& site) : site_(site), start_(threadAllocations()) {}
+
+        ~Scope()
+        {
+            if (!registry().armed_.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+
+            uint64_t allocations = threadAllocations() - start_;
+            if (site_.events_.fetch_add(1) >= warmupEvents && allocations > 0)
+            {
+                site_.allocatingEvents_.fetch_add(1);
+                site_.allocations_.fetch_add((int64_t) allocations);
+            }
+        }
+
+        Site& site_;
+        uint64_t start_;
+    };
+
+    // Prints each site's counts to stderr, returns false if any steady
+    // state event allocated.
+    inline bool report()
+    {
+        Registry& all = registry();
+        bool clean = true;
+        int count = all.siteCount_.load() < maxSites ? all.siteCount_.load() : maxSites;
+        for (int i = 0; i < count; i++)
+        {
+            const Site& site = *all.sites_[i];
+            fprintf(stderr, "alloc guard: %-28s %8lld events, %lld allocating (%lld allocations)\n",
+                    site.name_, (long long) site.events_.load(), (long long) site.allocatingEvents_.load(),
+                    (long long) site.allocations_.load());
+            clean = clean && site.allocatingEvents_.load() == 0;
+        }
+        return clean;
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    loop4rAlloc::threadAllocations()++;
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    loop4rAlloc::threadAllocations()++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept                          { std::free(p); }
+void operator delete[](void* p) noexcept                        { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept             { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept           { std::free(p); }
+
+ #define LOOP4R_ALLOC_GUARD_JOIN2(a, b) a##b
+ #define LOOP4R_ALLOC_GUARD_JOIN(a, b) LOOP4R_ALLOC_GUARD_JOIN2(a, b)
+ #define LOOP4R_ALLOC_GUARD_SCOPE(name) \
+    static loop4rAlloc::Site LOOP4R_ALLOC_GUARD_JOIN(loop4rAllocSite_, __LINE__) (name); \
+    loop4rAlloc::Scope LOOP4R_ALLOC_GUARD_JOIN(loop4rAllocScope_, __LINE__) (LOOP4R_ALLOC_GUARD_JOIN(loop4rAllocSite_, __LINE__))
+
+#else
+
+ #define LOOP4R_ALLOC_GUARD_SCOPE(name)
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "EngineSubscriptions.h"
+#include "LooperCore.h"
+#include "MidiClockTracker.h"
+#include <atomic>
+#include <cmath>
+
+enum QuantizeMode
+{
+    QuantizeOff,
+    QuantizeCycle,      // the loop's cycle, from loop_pos and cycle_len
+    QuantizeBeat,       // the external MIDI clock's beat
+    NumQuantizeModes
+};
+
+static const char* const quantizeModeNames[NumQuantizeModes] = { "off", "cycle", "beat" };
+
+/*
+ ==============================================================================
+ Works out when to send a pedal command so that it reaches the engine right
+ on the next cycle or beat boundary.
+
+ Each loop_pos update gives the time the loop's cycle started, taking the
+ update's transit from the engine into account; the earliest of the recent
+ estimates wins, since a late packet only ever makes the loop look late. The
+ transit time is half the smoothed round trip of /ping probes.
+ ==============================================================================
+ */
+class CommandQuantizer
+{
+public:
+    // presses this soon after a boundary go out right away rather than a cycle late
+    static constexpr double graceMs = 40.0;
+
+    CommandQuantizer(const LoopControlCache& controls, const MidiClockTracker& clock)
+    : controls_(controls), clock_(clock)
+    {
+        for (auto&& origin : origins_)
+        {
+            origin.store(0.0, std::memory_order_relaxed);
+        }
+    }
+
+    void setMode(QuantizeMode mode)
+    {
+        mode_ = mode;
+    }
+
+    QuantizeMode getMode() const
+    {
+        return mode_;
+    }
+
+    // a loop_pos update received at recvMs, called on the OSC receiver thread
+    void observePosition(int loop, float pos, double recvMs)
+    {
+        double cycleMs = cycleLengthMs(loop);
+        if (!isPositiveAndBelow(loop, LoopControlCache::maxLoops) || cycleMs <= 0.0)
+        {
+            return;
+        }
+
+        double sample = recvMs - transitMs_ - pos * 1000.0 / rate(loop);
+        double previous = origins_[loop].load(std::memory_order_relaxed);
+        double delta = std::remainder(sample - previous, cycleMs);
+
+        // a jump means the loop was retriggered or changed speed, otherwise only
+        // creep later to follow the clocks drifting apart
+        double origin = previous == 0.0 || std::abs(delta) > resyncMs ? sample : previous + jmin(delta, creepMs);
+        origins_[loop].store(origin, std::memory_order_relaxed);
+    }
+
+    // a /ping round trip in ms
+    void addRoundTrip(double ms)
+    {
+        double transit = transitMs_;
+        transitMs_ = transit == 0.0 ? ms * 0.5 : transit + 0.125 * (ms * 0.5 - transit);
+    }
+
+    double getTransitMs() const
+    {
+        return transitMs_;
+    }
+
+    // When to send a command for loop so it lands on the next boundary, or 0
+    // to send it now: quantizing is off, or there's nothing to quantize to.
+    double getSendTime(int loop, double nowMs) const
+    {
+        double transit = transitMs_;
+        double length = 0.0;
+        double phase = 0.0;   // ms since the last boundary, when the command would arrive
+
+        if (mode_ == QuantizeCycle)
+        {
+            double origin = isPositiveAndBelow(loop, LoopControlCache::maxLoops) ? origins_[loop].load(std::memory_order_relaxed) : 0.0;
+            length = cycleLengthMs(loop);
+            if (origin == 0.0 || length <= 0.0)
+            {
+                return 0.0;
+            }
+            phase = std::fmod(nowMs + transit - origin, length);
+            phase = phase < 0.0 ? phase + length : phase;
+        }
+        else if (mode_ == QuantizeBeat)
+        {
+            double beats = clock_.getBeatPosition(nowMs + transit);
+            double tempo = clock_.getTempo(nowMs);
+            if (beats < 0.0 || tempo <= 0.0)
+            {
+                return 0.0;
+            }
+            length = 60000.0 / tempo;
+            phase = (beats - std::floor(beats)) * length;
+        }
+        else
+        {
+            return 0.0;
+        }
+
+        return phase < graceMs ? 0.0 : nowMs + length - phase;
+    }
+
+private:
+    static constexpr double resyncMs = 20.0;
+    static constexpr double creepMs = 0.1;
+
+    double rate(int loop) const
+    {
+        // the cache holds 0 until the first rate update
+        float rate = controls_.getLoop(loop, CtrlRate);
+        return rate > 0.0f ? rate : 1.0;
+    }
+
+    double cycleLengthMs(int loop) const
+    {
+        return controls_.getLoop(loop, CtrlCycleLen) * 1000.0 / rate(loop);
+    }
+
+    const LoopControlCache& controls_;
+    const MidiClockTracker& clock_;
+    std::atomic<QuantizeMode> mode_ { QuantizeOff };
+    std::atomic<double> transitMs_ { 0.0 };
+    std::atomic<double> origins_[LoopControlCache::maxLoops];  // the cycle start, 0 until known
+
+    JUCE_DECLARE_NON_COPYABLE(CommandQuantizer)
+};
+
+//==============================================================================
+// The commands the quantizer held back, each with the time to send it. The
+// controller thread keeps it and sends them when its deadline comes up, in a
+// fixed number of slots so that holding a command never allocates.
+class CommandSchedule
+{
+public:
+    static const int capacity = 64;
+
+    // false if every slot is taken
+    bool add(double dueMs, const EngineCommand& command)
+    {
+        if (size_ == capacity)
+        {
+            return false;
+        }
+        pending_[size_++] = { dueMs, command };
+        latestDue_ = jmax(latestDue_, dueMs);
+        return true;
+    }
+
+    bool isEmpty() const
+    {
+        return size_ == 0;
+    }
+
+    // the earliest send time, 0 if nothing is pending
+    double nextDue() const
+    {
+        double earliest = 0.0;
+        for (auto i = 0; i < size_; i++)
+        {
+            earliest = i == 0 ? pending_[i].dueMs_ : jmin(earliest, pending_[i].dueMs_);
+        }
+        return earliest;
+    }
+
+    // the latest send time, 0 if nothing is pending
+    double getLatestPending() const
+    {
+        return size_ > 0 ? latestDue_ : 0.0;
+    }
+
+    // Calls send(command) for each command due by nowMs, the earliest first
+    // and those due together in the order they were added
+    template <typename Send>
+    void sendDue(double nowMs, Send&& send)
+    {
+        for (;;)
+        {
+            int next = -1;
+            for (auto i = 0; i < size_; i++)
+            {
+                if (pending_[i].dueMs_ <= nowMs && (next < 0 || pending_[i].dueMs_ < pending_[next].dueMs_))
+                {
+                    next = i;
+                }
+            }
+            if (next < 0)
+            {
+                break;
+            }
+
+            EngineCommand command = pending_[next].command_;
+            for (auto i = next + 1; i < size_; i++)
+            {
+                pending_[i - 1] = pending_[i];
+            }
+            size_--;
+            send(command);
+        }
+
+        if (size_ == 0)
+        {
+            latestDue_ = 0.0;
+        }
+    }
+
+private:
+    struct Pending
+    {
+        double dueMs_;
+        EngineCommand command_;
+    };
+
+    Pending pending_[capacity];
+    int size_ = 0;
+    double latestDue_ = 0.0;
+};
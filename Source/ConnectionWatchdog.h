@@ -0,0 +1,218 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/*
+ ==============================================================================
+ Watches one engine's liveness on its own thread, paced by a timerfd.
+
+ Every datagram received from the engine counts as a sign of life (see
+ heard()). When the engine has been quiet for half the window it is probed
+ with a /ping answered on the probe path; once quiet for the whole window it
+ is declared lost and re-pinged on the /pingack path with exponential backoff,
+ so that the controller resyncs when the reply comes in.
+
+ State changes are published on the message thread through onStateChange.
+ ==============================================================================
+ */
+class ConnectionWatchdog : private Thread
+{
+public:
+    enum State
+    {
+        Connecting,     // never heard from the engine yet
+        Connected,
+        Lost
+    };
+
+    static const int defaultWindowMs = 300;
+    static const int minBackoffMs = 100;
+    static const int maxBackoffMs = 5000;
+
+    std::function<void (State)> onStateChange;
+
+    ConnectionWatchdog(const String& name) : Thread("watchdog " + name), name_(name) {}
+
+    ~ConnectionWatchdog()
+    {
+        stop();
+    }
+
+    // (Re)starts watching the engine at host:port, probes ask for replies at returnUrl.
+    bool start(const String& host, int port, const String& returnUrl, int windowMs)
+    {
+        stop();
+
+        if (!sender_.connect(host, port))
+        {
+            std::cerr << "Watchdog could not connect to " << host << ":" << port << std::endl;
+            return false;
+        }
+
+        returnUrl_ = returnUrl;
+        windowMs_ = jmax(20, windowMs);
+        state_ = Connecting;
+        startThread(7);
+        return true;
+    }
+
+    void stop()
+    {
+        stopThread(1000);
+        sender_.disconnect();
+    }
+
+    // Called from the OSC receiver thread for every datagram.
+    void heard()
+    {
+        lastHeard_.store(Time::getMillisecondCounter(), std::memory_order_relaxed);
+    }
+
+    State getState() const
+    {
+        return state_;
+    }
+
+    bool isRunning() const
+    {
+        return isThreadRunning();
+    }
+
+    // times the engine went quiet for half a window and had to be probed
+    int64 getProbeCount() const
+    {
+        return probes_;
+    }
+
+private:
+    void run() override
+    {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0)
+        {
+            std::cerr << "Watchdog could not create its timer" << std::endl;
+            return;
+        }
+
+        // tick four times per window, that keeps detection within window + window/4
+        int tickMs = jmax(5, windowMs_ / 4);
+        itimerspec spec = {};
+        spec.it_interval.tv_sec = tickMs / 1000;
+        spec.it_interval.tv_nsec = (tickMs % 1000) * 1000000L;
+        spec.it_value = spec.it_interval;
+        timerfd_settime(fd, 0, &spec, nullptr);
+
+        uint32 now = Time::getMillisecondCounter();
+        nextAttempt_ = now + (uint32) windowMs_; // the controller sends the first ping itself
+        lastProbe_ = now;
+        backoff_ = minBackoffMs;
+
+        pollfd pfd = { fd, POLLIN, 0 };
+        while (!threadShouldExit())
+        {
+            // wake up regularly to notice stopThread()
+            if (poll(&pfd, 1, 100) <= 0)
+            {
+                continue;
+            }
+
+            uint64 expirations;
+            if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+            {
+                tick(Time::getMillisecondCounter());
+            }
+        }
+
+        close(fd);
+    }
+
+    void tick(uint32 now)
+    {
+        uint32 lastHeard = lastHeard_.load(std::memory_order_relaxed);
+        bool heardRecently = lastHeard != 0 && now - lastHeard <= (uint32) windowMs_;
+
+        switch (state_)
+        {
+            case Connected:
+                if (!heardRecently)
+                {
+                    std::cerr << "Lost " << name_ << ", nothing heard for " << (int) (now - lastHeard) << " ms" << std::endl;
+                    backoff_ = minBackoffMs;
+                    nextAttempt_ = now;
+                    setState(Lost);
+                }
+                else if (now - lastHeard > (uint32) windowMs_ / 2 && now - lastProbe_ >= (uint32) windowMs_ / 4)
+                {
+                    // quiet engine, make it answer
+                    sender_.send("/ping", returnUrl_, (String) "/loop4r/alive");
+                    lastProbe_ = now;
+                    probes_.fetch_add(1, std::memory_order_relaxed);
+                }
+                break;
+
+            case Connecting:
+            case Lost:
+                if (heardRecently && (int) (lastHeard - stateSince_) >= 0)
+                {
+                    setState(Connected);
+                }
+                else if ((int) (now - nextAttempt_) >= 0)
+                {
+                    sender_.send("/ping", returnUrl_, (String) "/pingack");
+                    nextAttempt_ = now + (uint32) backoff_;
+                    backoff_ = jmin(backoff_ * 2, maxBackoffMs);
+                }
+                break;
+        }
+    }
+
+    void setState(State state)
+    {
+        state_ = state;
+        stateSince_ = Time::getMillisecondCounter();
+
+        auto callback = onStateChange;
+        if (callback != nullptr)
+        {
+            MessageManager::callAsync([callback, state] { callback(state); });
+        }
+    }
+
+    String name_;
+    OSCSender sender_;
+    String returnUrl_;
+    int windowMs_ = defaultWindowMs;
+    std::atomic<State> state_ { Connecting };
+    std::atomic<uint32> lastHeard_ { 0 };
+    std::atomic<int64> probes_ { 0 };
+
+    // only used on the watchdog thread
+    uint32 stateSince_ = 0;
+    uint32 nextAttempt_ = 0;
+    uint32 lastProbe_ = 0;
+    int backoff_ = minBackoffMs;
+
+    JUCE_DECLARE_NON_COPYABLE(ConnectionWatchdog)
+};
@@ -0,0 +1,297 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LooperCore.h"
+#include <atomic>
+#include <functional>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <vector>
+
+//==============================================================================
+// LooperEvents from one producer thread to the controller. push() is wait
+// free and never allocates; when the queue is full the event is dropped and
+// counted.
+class LooperEventQueue : public LooperInput
+{
+public:
+    LooperEventQueue(int capacity = 256)
+    : fifo_(capacity), events_((size_t) capacity)
+    {
+    }
+
+    // producer side
+    bool push(const LooperEvent& event)
+    {
+        int start1, size1, start2, size2;
+        fifo_.prepareToWrite(1, start1, size1, start2, size2);
+        if (size1 == 0)
+        {
+            drops_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        events_[(size_t) start1] = event;
+        fifo_.finishedWrite(1);
+        return true;
+    }
+
+    // consumer side
+    bool next(LooperEvent& event) override
+    {
+        int start1, size1, start2, size2;
+        fifo_.prepareToRead(1, start1, size1, start2, size2);
+        if (size1 == 0)
+        {
+            return false;
+        }
+        event = events_[(size_t) start1];
+        fifo_.finishedRead(1);
+        return true;
+    }
+
+    int64 getDropCount() const
+    {
+        return drops_;
+    }
+
+private:
+    AbstractFifo fifo_;
+    std::vector<LooperEvent> events_;
+    std::atomic<int64> drops_ { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(LooperEventQueue)
+};
+
+/*
+ ==============================================================================
+ The one thread that drives the controller: everything that reads or changes
+ the core, and everything the core sends, happens on it.
+
+ The MIDI, OSC and timer threads push compact events into a LooperEventQueue
+ each and wake the controller, so they're back in their own loops right away.
+ Rarer work, like the engine handshake or opening an output, is handed over
+ as a function with call(); that takes a lock and may allocate, which the
+ event queues never do.
+
+ After the calls and events of each wake up, the client's controllerWoke()
+ runs, e.g. to pick up what the OSC thread left in a latest-value cache.
+ Between wake ups the thread sleeps until the client's next deadline, if it
+ has one, on a timerfd so that it wakes well within a millisecond of it.
+ ==============================================================================
+ */
+class ControllerThread : private Thread
+{
+public:
+    struct Client
+    {
+        virtual ~Client() {}
+        virtual void controllerEvent(const LooperEvent& event) = 0;
+        virtual void controllerWoke() = 0;
+
+        // Time::getMillisecondCounterHiRes() by which the controller should
+        // wake up even if nothing happens, 0 for none
+        virtual double controllerDeadline() { return 0.0; }
+    };
+
+    ControllerThread(Client& client)
+    : Thread("controller"), client_(client), wakeFd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      timerFd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+    {
+    }
+
+    ~ControllerThread()
+    {
+        stop();
+        if (wakeFd_ >= 0)
+        {
+            ::close(wakeFd_);
+        }
+        if (timerFd_ >= 0)
+        {
+            ::close(timerFd_);
+        }
+    }
+
+    // inputs can only be added before start()
+    void addInput(LooperEventQueue& input)
+    {
+        jassert(!isThreadRunning());
+        inputs_.push_back(&input);
+    }
+
+    void start()
+    {
+        if (isThreadRunning())
+        {
+            return;
+        }
+        startThread(8);
+    }
+
+    void stop()
+    {
+        if (!isThreadRunning())
+        {
+            return;
+        }
+        signalThreadShouldExit();
+        wake();
+        stopThread(1000);
+    }
+
+    // Safe to call from any thread, and wait free. The eventfd lives as long
+    // as the controller, so the calls made before start() are still pending.
+    void wake()
+    {
+        if (wakeFd_ >= 0)
+        {
+            uint64 one = 1;
+            ssize_t ignored = ::write(wakeFd_, &one, sizeof(one));
+            (void) ignored;
+        }
+    }
+
+    // pushes event to input and wakes the controller
+    void post(LooperEventQueue& input, const LooperEvent& event)
+    {
+        input.push(event);
+        wake();
+    }
+
+    // Runs fn on the controller thread, before the events of its next wake up.
+    // Calls made before start() run once it has started.
+    void call(std::function<void()> fn)
+    {
+        {
+            const ScopedLock sl(callLock_);
+            calls_.push_back(std::move(fn));
+        }
+        wake();
+    }
+
+    // Also wakes the controller every intervalMs, 0 only when woken
+    void setWakeInterval(int intervalMs)
+    {
+        wakeInterval_ = intervalMs;
+        wake();
+    }
+
+    bool isControllerThread() const
+    {
+        return Thread::getCurrentThreadId() == getThreadId();
+    }
+
+private:
+    void run() override
+    {
+        pollfd fds[2] = { { wakeFd_, POLLIN, 0 }, { timerFd_, POLLIN, 0 } };
+        while (!threadShouldExit())
+        {
+            int timeout = wakeInterval_;
+            if (timeout <= 0)
+            {
+                timeout = -1;
+            }
+
+            arm(client_.controllerDeadline());
+            if (poll(fds, 2, timeout) > 0)
+            {
+                uint64 value;
+                for (auto&& fd : fds)
+                {
+                    if (fd.revents & POLLIN)
+                    {
+                        ssize_t ignored = ::read(fd.fd, &value, sizeof(value));
+                        (void) ignored;
+                    }
+                }
+            }
+
+            if (threadShouldExit())
+            {
+                return;
+            }
+
+            runCalls();
+
+            LooperEvent event;
+            for (LooperEventQueue* input : inputs_)
+            {
+                while (input->next(event))
+                {
+                    client_.controllerEvent(event);
+                }
+            }
+
+            client_.controllerWoke();
+        }
+    }
+
+    // CLOCK_MONOTONIC is what getMillisecondCounterHiRes() reads on Linux,
+    // 0 disarms the timer
+    void arm(double deadlineMs)
+    {
+        itimerspec spec = {};
+        if (deadlineMs > 0.0)
+        {
+            int64 ns = (int64) (deadlineMs * 1000000.0);
+            spec.it_value.tv_sec = (time_t) (ns / 1000000000);
+            spec.it_value.tv_nsec = (long) (ns % 1000000000);
+            if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+            {
+                spec.it_value.tv_nsec = 1; // zero would disarm it
+            }
+        }
+        timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    void runCalls()
+    {
+        {
+            const ScopedLock sl(callLock_);
+            if (calls_.empty())
+            {
+                return;
+            }
+            running_.swap(calls_);
+        }
+
+        for (auto&& fn : running_)
+        {
+            fn();
+        }
+        running_.clear();
+    }
+
+    Client& client_;
+    std::vector<LooperEventQueue*> inputs_;
+    const int wakeFd_;
+    const int timerFd_;
+    std::atomic<int> wakeInterval_ { 0 };
+
+    CriticalSection callLock_;
+    std::vector<std::function<void()>> calls_;
+    std::vector<std::function<void()>> running_;   // controller thread only
+
+    JUCE_DECLARE_NON_COPYABLE(ControllerThread)
+};
@@ -0,0 +1,308 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OscSendQueue.h"
+#include <atomic>
+
+//==============================================================================
+// Per-loop controls loop4r subscribes to. The order is the bit order in the
+// cache's dirty masks.
+enum LoopControl
+{
+    CtrlState,
+    CtrlLoopPos,
+    CtrlCycleLen,
+    CtrlRate,
+    NumLoopControls
+};
+
+static const char* const loopControlNames[NumLoopControls] =
+{
+    "state", "loop_pos", "cycle_len", "rate"
+};
+
+// the controls the controller acts on as soon as they change, the quantizer
+// reads the others straight from the cache
+static const uint32 wakingLoopControls = 1u << CtrlState;
+
+enum GlobalControl
+{
+    CtrlSelectedLoopNum,
+    NumGlobalControls
+};
+
+static const char* const globalControlNames[NumGlobalControls] =
+{
+    "selected_loop_num"
+};
+
+template <int N>
+inline int controlIndex(const char* const (&names)[N], const char* name)
+{
+    for (auto i = 0; i < N; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//==============================================================================
+/*
+ Latest-value cache for engine /ctrl updates.
+
+ The OSC receiver thread stores each update and marks it dirty; the controller
+ drains the dirty entries when it wakes up, so any intermediate values that
+ arrived in between are simply overwritten rather than processed. Only state
+ and selection changes wake it, the rest wait for the next tick.
+ */
+class LoopControlCache
+{
+public:
+    static const int maxLoops = 128;
+
+    LoopControlCache()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (auto i = 0; i <= maxLoops; i++)
+        {
+            for (auto&& value : values_[i])
+            {
+                value.store(0.0f, std::memory_order_relaxed);
+            }
+            dirty_[i].store(0, std::memory_order_relaxed);
+        }
+        for (auto&& word : dirtyRows_)
+        {
+            word.store(0, std::memory_order_relaxed);
+        }
+        wakePending_.store(false, std::memory_order_relaxed);
+    }
+
+    // Called from the OSC receiver thread. Returns true if the consumer needs
+    // to be woken up: a control it acts on changed, and it wasn't woken for
+    // one since its last drain.
+    bool setLoop(int loop, int control, float value)
+    {
+        if (!isPositiveAndBelow(loop, maxLoops) || !isPositiveAndBelow(control, (int)NumLoopControls))
+        {
+            return false;
+        }
+        return set(loop, control, value, (wakingLoopControls & (1u << control)) != 0);
+    }
+
+    bool setGlobal(int control, float value)
+    {
+        if (!isPositiveAndBelow(control, (int)NumGlobalControls))
+        {
+            return false;
+        }
+        return set(maxLoops, control, value, true);
+    }
+
+    float getLoop(int loop, int control) const
+    {
+        return isPositiveAndBelow(loop, maxLoops) ? values_[loop][control].load(std::memory_order_relaxed) : 0.0f;
+    }
+
+    float getGlobal(int control) const
+    {
+        return values_[maxLoops][control].load(std::memory_order_relaxed);
+    }
+
+    // Called on each controller wake up. fn(row, dirtyMask) is called for every
+    // loop with pending updates, row == -2 for the global controls to match
+    // SooperLooper's /ctrl loop index.
+    template <typename Fn>
+    bool drain(Fn&& fn)
+    {
+        // before looking at the rows, so that an update after it wakes again
+        wakePending_.exchange(false, std::memory_order_acq_rel);
+        bool any = false;
+        for (auto w = 0; w < numWords; w++)
+        {
+            uint64 rows = dirtyRows_[w].exchange(0, std::memory_order_acquire);
+            while (rows != 0)
+            {
+                int bit = countTrailingZeros(rows);
+                rows &= rows - 1;
+
+                int row = w * 64 + bit;
+                uint32 mask = dirty_[row].exchange(0, std::memory_order_acquire);
+                if (mask != 0)
+                {
+                    any = true;
+                    fn(row == maxLoops ? -2 : row, mask);
+                }
+            }
+        }
+        return any;
+    }
+
+private:
+    enum { numWords = (maxLoops + 1 + 63) / 64 };
+
+    bool set(int row, int control, float value, bool wakes)
+    {
+        values_[row][control].store(value, std::memory_order_relaxed);
+        dirty_[row].fetch_or(1u << control, std::memory_order_release);
+        uint64 bit = (uint64)1 << (row % 64);
+        dirtyRows_[row / 64].fetch_or(bit, std::memory_order_release);
+        return wakes && !wakePending_.exchange(true, std::memory_order_acq_rel);
+    }
+
+    static int countTrailingZeros(uint64 value)
+    {
+        return __builtin_ctzll(value);
+    }
+
+    // one row per loop, plus a row for the global controls
+    std::atomic<float> values_[maxLoops + 1][jmax((int)NumLoopControls, (int)NumGlobalControls)];
+    std::atomic<uint32> dirty_[maxLoops + 1];
+    std::atomic<uint64> dirtyRows_[numWords];
+    std::atomic<bool> wakePending_ { false };
+
+    JUCE_DECLARE_NON_COPYABLE(LoopControlCache)
+};
+
+//==============================================================================
+/*
+ Keeps track of the auto update registrations loop4r holds with the engine, so
+ that a loop's controls can be re-registered at a different interval.
+ */
+class EngineSubscriptions
+{
+public:
+    EngineSubscriptions(OSCSender& sender, OscSendQueue& queue)
+    : sender_(sender), queue_(queue)
+    {
+        reset();
+    }
+
+    void setReturnUrl(const String& url)
+    {
+        returnUrl_ = url;
+    }
+
+    // Registers all loop controls at the given interval; does nothing if the
+    // loop is already registered at that interval.
+    void subscribeLoop(int index, int intervalMs)
+    {
+        if (!isPositiveAndBelow(index, maxLoops) || intervals_[index] == intervalMs)
+        {
+            return;
+        }
+
+        if (intervals_[index] > 0)
+        {
+            unsubscribeLoop(index);
+        }
+
+        char path[48];
+        snprintf(path, sizeof(path), "/sl/%d/register_auto_update", index);
+        for (auto control : loopControlNames)
+        {
+            OscPacket packet(path, "siss");
+            packet.addString(control);
+            packet.addInt32(intervalMs);
+            packet.addString(returnUrl_.toRawUTF8());
+            packet.addString("/ctrl");
+            queue_.post(sender_, packet, OscSendQueue::EngineLane);
+        }
+        intervals_[index] = intervalMs;
+    }
+
+    void unsubscribeLoop(int index)
+    {
+        if (!isPositiveAndBelow(index, maxLoops))
+        {
+            return;
+        }
+
+        char path[48];
+        snprintf(path, sizeof(path), "/sl/%d/unregister_auto_update", index);
+        sendControls(path, loopControlNames);
+        intervals_[index] = 0;
+    }
+
+    // Asks for the current value of every loop control.
+    void queryLoop(int index)
+    {
+        char path[48];
+        snprintf(path, sizeof(path), "/sl/%d/get", index);
+        sendControls(path, loopControlNames);
+    }
+
+    void subscribeGlobal(bool unreg)
+    {
+        sendControls(unreg ? "/unregister_update" : "/register_update", globalControlNames);
+    }
+
+    void queryGlobal()
+    {
+        sendControls("/get", globalControlNames);
+    }
+
+    int intervalFor(int index) const
+    {
+        return isPositiveAndBelow(index, maxLoops) ? intervals_[index] : 0;
+    }
+
+    // Forgets all registrations, e.g. after the engine was restarted.
+    void reset()
+    {
+        for (auto&& interval : intervals_)
+        {
+            interval = 0;
+        }
+    }
+
+private:
+    static const int maxLoops = LoopControlCache::maxLoops;
+
+    // path for each control, with /ctrl at our return url as the reply;
+    // these go out whenever a loop changes state, so they're encoded on the stack
+    template <int N>
+    void sendControls(const char* path, const char* const (&names)[N])
+    {
+        for (auto control : names)
+        {
+            OscPacket packet(path, "sss");
+            packet.addString(control);
+            packet.addString(returnUrl_.toRawUTF8());
+            packet.addString("/ctrl");
+            queue_.post(sender_, packet, OscSendQueue::EngineLane);
+        }
+    }
+
+    OSCSender& sender_;
+    OscSendQueue& queue_;
+    String returnUrl_;
+    int intervals_[maxLoops]; // 0 = not registered
+
+    JUCE_DECLARE_NON_COPYABLE(EngineSubscriptions)
+};
@@ -0,0 +1,618 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "EngineSubscriptions.h"
+
+/*
+ ==============================================================================
+ A stand-in for SooperLooper that implements the part of its OSC interface
+ loop4r uses, for load testing without jackd or audio hardware:
+
+    /ping s:returl s:retpath
+    /register_update, /unregister_update s:ctrl s:returl s:retpath
+    /get s:ctrl s:returl s:retpath, /set s:ctrl f:value
+    /sl/#/register_auto_update s:ctrl i:ms s:returl s:retpath
+    /sl/#/unregister_auto_update s:ctrl s:returl s:retpath
+    /sl/#/get s:ctrl s:returl s:retpath
+    /sl/#/down, /sl/#/up, /sl/#/hit s:command
+
+ Loops run a simplified version of SooperLooper's state machine in real time.
+ Besides the regular auto updates, it can flood every registered client with
+ a fixed rate of extra state updates to find where loop4r saturates.
+ ==============================================================================
+ */
+class FakeSooperLooper : private OSCReceiver::Listener<OSCReceiver::RealtimeCallback>,
+                         private Thread
+{
+public:
+    FakeSooperLooper() : Thread("fake sooperlooper")
+    {
+        engineId_ = (int) (Time::currentTimeMillis() & 0x7fffffff);
+    }
+
+    ~FakeSooperLooper()
+    {
+        stop();
+    }
+
+    // sync makes record start and stop wait for the next cycle of loop 0,
+    // going through WaitStart and WaitStop like a synced SooperLooper
+    bool start(int port, int loopCount, int floodRate, bool sync = true)
+    {
+        loops_.clear();
+        for (auto i = 0; i < jlimit(1, LoopControlCache::maxLoops, loopCount); i++)
+        {
+            loops_.add(FakeLoop());
+        }
+        floodRate_ = floodRate;
+        sync_ = sync;
+
+        if (!receiver_.connect(port))
+        {
+            std::cerr << "Fake engine: could not listen on UDP port " << port << std::endl;
+            return false;
+        }
+        receiver_.addListener(this);
+        hostUrl_ = "osc.udp://localhost:" + String(port) + "/";
+        startThread(8);
+
+        std::cerr << "Fake engine listening on port " << port << " with " << loops_.size() << " loops";
+        if (floodRate_ > 0)
+        {
+            std::cerr << ", flooding " << floodRate_ << " updates/s";
+        }
+        std::cerr << std::endl;
+        return true;
+    }
+
+    void stop()
+    {
+        receiver_.removeListener(this);
+        receiver_.disconnect();
+        stopThread(2000);
+    }
+
+private:
+    // SooperLooper's state numbers, as in loop4r's LoopStates
+    enum State
+    {
+        Off = 0,
+        WaitStart = 1,
+        Recording = 2,
+        WaitStop = 3,
+        Playing = 4,
+        Overdubbing = 5,
+        Multiplying = 6,
+        Inserting = 7,
+        Replacing = 8,
+        Muted = 10,
+        Substitute = 13
+    };
+
+    struct FakeLoop
+    {
+        int state_ = Off;
+        double pos_ = 0.0;       // seconds
+        double length_ = 0.0;    // seconds
+        double cycle_ = 0.0;     // seconds
+        double wet_ = 1.0;
+        double rate_ = 1.0;
+        double waitUntil_ = -1;  // engine time at which a WaitStart/WaitStop resolves
+    };
+
+    struct Registration
+    {
+        int loop_;               // -2 for global controls
+        String control_;
+        int interval_;           // 0 for /register_update, sent on change only
+        String url_;
+        String path_;
+        double lastSent_;
+        float lastValue_;
+    };
+
+    //==============================================================================
+    void oscMessageReceived(const OSCMessage& message) override
+    {
+        const ScopedLock sl(lock_);
+
+        String address = message.getAddressPattern().toString();
+        if (address == "/ping")
+        {
+            if (message.size() >= 2 && message[0].isString() && message[1].isString())
+            {
+                reply(message[0].getString(), message[1].getString(),
+                      hostUrl_, (String) engineVersion, (int) loops_.size(), (int) engineId_);
+                addClient(message[0].getString());
+            }
+        }
+        else if (address == "/register_update" || address == "/unregister_update")
+        {
+            if (message.size() >= 3 && message[0].isString() && message[1].isString() && message[2].isString())
+            {
+                setRegistration(-2, message[0].getString(), 0, message[1].getString(), message[2].getString(),
+                                address == "/unregister_update");
+            }
+        }
+        else if (address == "/get")
+        {
+            if (message.size() >= 3 && message[0].isString() && message[1].isString() && message[2].isString())
+            {
+                reply(message[1].getString(), message[2].getString(), (int) -2, message[0].getString(),
+                      getValue(-2, message[0].getString()));
+            }
+        }
+        else if (address == "/set")
+        {
+            if (message.size() >= 2 && message[0].isString() && message[0].getString() == "selected_loop_num")
+            {
+                int loop = message[1].isInt32() ? message[1].getInt32() : message[1].isFloat32() ? (int) message[1].getFloat32() : 0;
+                selectedLoop_ = jlimit(0, loops_.size() - 1, loop);
+                notifyGlobal("selected_loop_num");
+            }
+        }
+        else if (address.startsWith("/sl/"))
+        {
+            handleLoopMessage(address, message);
+        }
+    }
+
+    void handleLoopMessage(const String& address, const OSCMessage& message)
+    {
+        String rest = address.substring(4);
+        int loop = rest.upToFirstOccurrenceOf("/", false, false).getIntValue();
+        String method = rest.fromFirstOccurrenceOf("/", false, false);
+
+        if (method == "register_auto_update" || method == "unregister_auto_update")
+        {
+            bool unreg = method == "unregister_auto_update";
+            int argc = unreg ? 3 : 4;
+            if (message.size() >= argc && message[0].isString() && message[argc - 2].isString() && message[argc - 1].isString())
+            {
+                int interval = !unreg && message[1].isInt32() ? message[1].getInt32() : 0;
+                forEachLoop(loop, [&] (int index)
+                {
+                    setRegistration(index, message[0].getString(), jmax(1, interval),
+                                    message[argc - 2].getString(), message[argc - 1].getString(), unreg);
+                });
+            }
+        }
+        else if (method == "get")
+        {
+            if (message.size() >= 3 && message[0].isString() && message[1].isString() && message[2].isString())
+            {
+                forEachLoop(loop, [&] (int index)
+                {
+                    reply(message[1].getString(), message[2].getString(), (int) index, message[0].getString(),
+                          getValue(index, message[0].getString()));
+                });
+            }
+        }
+        else if (method == "down" || method == "up" || method == "hit")
+        {
+            if (message.size() >= 1 && message[0].isString())
+            {
+                String command = message[0].getString();
+                forEachLoop(loop, [&] (int index)
+                {
+                    // SooperLooper acts on the press; a hit is a press and release
+                    if (method != "up")
+                    {
+                        applyCommand(index, command);
+                    }
+                });
+            }
+        }
+    }
+
+    template <typename Fn>
+    void forEachLoop(int loop, Fn&& fn)
+    {
+        if (loop == -1)
+        {
+            for (auto i = 0; i < loops_.size(); i++)
+            {
+                fn(i);
+            }
+        }
+        else if (loop == -3)
+        {
+            fn(selectedLoop_);
+        }
+        else if (isPositiveAndBelow(loop, loops_.size()))
+        {
+            fn(loop);
+        }
+    }
+
+    //==============================================================================
+    // A simplified SooperLooper state machine, enough to exercise loop4r's LEDs.
+    void applyCommand(int index, const String& command)
+    {
+        FakeLoop& loop = loops_.getReference(index);
+        int state = loop.state_;
+        bool empty = loop.length_ <= 0.0;
+
+        if (command == "record")
+        {
+            if (state == Off || (empty && state != Recording && state != WaitStart))
+            {
+                double boundary = nextSyncBoundary(index);
+                if (boundary >= 0)
+                {
+                    setState(index, WaitStart);
+                    loop.waitUntil_ = boundary;
+                }
+                else
+                {
+                    startRecording(loop);
+                    setState(index, Recording);
+                }
+            }
+            else if (state == Recording)
+            {
+                double boundary = nextSyncBoundary(index);
+                if (boundary >= 0)
+                {
+                    setState(index, WaitStop);
+                    loop.waitUntil_ = boundary;
+                }
+                else
+                {
+                    finishRecording(loop);
+                    setState(index, Playing);
+                }
+            }
+            else if (state == WaitStart)
+            {
+                setState(index, Off);
+            }
+        }
+        else if (command == "overdub")
+        {
+            toggle(index, Overdubbing);
+        }
+        else if (command == "multiply")
+        {
+            if (state == Multiplying)
+            {
+                loop.length_ += loop.cycle_;
+                setState(index, Playing);
+            }
+            else
+            {
+                toggle(index, Multiplying);
+            }
+        }
+        else if (command == "insert")
+        {
+            toggle(index, Inserting);
+        }
+        else if (command == "replace")
+        {
+            toggle(index, Replacing);
+        }
+        else if (command == "substitute")
+        {
+            toggle(index, Substitute);
+        }
+        else if (command == "mute")
+        {
+            if (state == Muted)
+            {
+                setState(index, Playing);
+            }
+            else if (!empty)
+            {
+                setState(index, Muted);
+            }
+        }
+        else if (command == "mute_on")
+        {
+            if (!empty)
+            {
+                setState(index, Muted);
+            }
+        }
+        else if (command == "mute_off")
+        {
+            if (state == Muted)
+            {
+                setState(index, Playing);
+            }
+        }
+        else if (command == "trigger")
+        {
+            if (!empty)
+            {
+                loop.pos_ = 0.0;
+                setState(index, Playing);
+            }
+        }
+        else if (command == "undo_all")
+        {
+            loop.length_ = loop.cycle_ = loop.pos_ = 0.0;
+            setState(index, Off);
+        }
+        else if (command == "undo")
+        {
+            if (state != Off && state != Playing && state != Muted)
+            {
+                setState(index, empty ? Off : Playing);
+            }
+        }
+    }
+
+    void toggle(int index, int activeState)
+    {
+        FakeLoop& loop = loops_.getReference(index);
+        if (loop.state_ == activeState)
+        {
+            setState(index, Playing);
+        }
+        else if (loop.length_ > 0.0 && (loop.state_ == Playing || loop.state_ == Muted))
+        {
+            setState(index, activeState);
+        }
+    }
+
+    void startRecording(FakeLoop& loop)
+    {
+        loop.pos_ = loop.length_ = loop.cycle_ = 0.0;
+    }
+
+    void finishRecording(FakeLoop& loop)
+    {
+        loop.length_ = loop.cycle_ = jmax(0.1, loop.pos_);
+        loop.pos_ = 0.0;
+    }
+
+    // engine time of loop 0's next cycle start, or -1 if there's nothing to sync to
+    double nextSyncBoundary(int index) const
+    {
+        if (!sync_ || index == 0)
+        {
+            return -1;
+        }
+
+        const FakeLoop& master = loops_.getReference(0);
+        if (master.cycle_ <= 0.0 || master.state_ == Off || master.state_ == Recording)
+        {
+            return -1;
+        }
+
+        return now_ + (master.cycle_ - std::fmod(master.pos_, master.cycle_)) / master.rate_;
+    }
+
+    void setState(int index, int state)
+    {
+        FakeLoop& loop = loops_.getReference(index);
+        if (loop.state_ != state)
+        {
+            loop.state_ = state;
+            notify(index, "state");
+        }
+    }
+
+    float getValue(int index, const String& control) const
+    {
+        if (index == -2)
+        {
+            return control == "selected_loop_num" ? (float) selectedLoop_ : 0.0f;
+        }
+
+        if (!isPositiveAndBelow(index, loops_.size()))
+        {
+            return 0.0f;
+        }
+
+        const FakeLoop& loop = loops_.getReference(index);
+        if (control == "state")         return (float) loop.state_;
+        if (control == "loop_pos")      return (float) loop.pos_;
+        if (control == "loop_len")      return (float) loop.length_;
+        if (control == "cycle_len")     return (float) loop.cycle_;
+        if (control == "wet")           return (float) loop.wet_;
+        if (control == "rate")          return (float) loop.rate_;
+        return 0.0f;
+    }
+
+    //==============================================================================
+    void setRegistration(int loop, const String& control, int interval, const String& url, const String& path, bool unreg)
+    {
+        for (auto i = registrations_.size(); --i >= 0;)
+        {
+            const Registration& r = registrations_.getReference(i);
+            if (r.loop_ == loop && r.control_ == control && r.url_ == url && r.path_ == path)
+            {
+                registrations_.remove(i);
+            }
+        }
+
+        if (!unreg)
+        {
+            registrations_.add({loop, control, interval, url, path, 0.0, std::numeric_limits<float>::quiet_NaN()});
+            addClient(url);
+        }
+    }
+
+    // sends a changed value right away to the clients registered for it
+    void notify(int index, const char* control)
+    {
+        for (auto&& r : registrations_)
+        {
+            if (r.loop_ == index && r.control_ == control)
+            {
+                sendRegistration(r);
+            }
+        }
+    }
+
+    void notifyGlobal(const char* control)
+    {
+        notify(-2, control);
+    }
+
+    void sendRegistration(Registration& r)
+    {
+        float value = getValue(r.loop_, r.control_);
+        reply(r.url_, r.path_, (int) r.loop_, r.control_, value);
+        r.lastValue_ = value;
+        r.lastSent_ = now_;
+    }
+
+    //==============================================================================
+    void run() override
+    {
+        double start = Time::getMillisecondCounterHiRes() * 0.001;
+        double lastHeartbeat = 0.0;
+        double floodDebt = 0.0;
+        int floodLoop = 0;
+
+        while (!threadShouldExit())
+        {
+            {
+                const ScopedLock sl(lock_);
+                double now = Time::getMillisecondCounterHiRes() * 0.001 - start;
+                double dt = now - now_;
+                now_ = now;
+
+                advanceLoops(dt);
+
+                for (auto&& r : registrations_)
+                {
+                    if (r.interval_ > 0 && now_ - r.lastSent_ >= r.interval_ * 0.001
+                        && getValue(r.loop_, r.control_) != r.lastValue_)
+                    {
+                        sendRegistration(r);
+                    }
+                }
+
+                if (floodRate_ > 0 && !loops_.isEmpty())
+                {
+                    floodDebt += dt * floodRate_;
+                    for (; floodDebt >= 1.0; floodDebt -= 1.0)
+                    {
+                        floodLoop = (floodLoop + 1) % loops_.size();
+                        for (auto&& url : clients_)
+                        {
+                            reply(url, "/ctrl", (int) floodLoop, (String) "state", getValue(floodLoop, "state"));
+                        }
+                    }
+                }
+
+                if (now_ - lastHeartbeat >= 1.0)
+                {
+                    lastHeartbeat = now_;
+                    for (auto&& url : clients_)
+                    {
+                        reply(url, "/heartbeat", hostUrl_, (String) engineVersion, (int) loops_.size(), (int) engineId_);
+                    }
+                }
+            }
+            wait(1);
+        }
+    }
+
+    void advanceLoops(double dt)
+    {
+        for (auto i = 0; i < loops_.size(); i++)
+        {
+            FakeLoop& loop = loops_.getReference(i);
+            switch (loop.state_)
+            {
+                case WaitStart:
+                    if (now_ >= loop.waitUntil_)
+                    {
+                        startRecording(loop);
+                        setState(i, Recording);
+                    }
+                    break;
+                case WaitStop:
+                    loop.pos_ += dt * loop.rate_;
+                    if (now_ >= loop.waitUntil_)
+                    {
+                        finishRecording(loop);
+                        setState(i, Playing);
+                    }
+                    break;
+                case Recording:
+                    loop.pos_ += dt * loop.rate_;
+                    break;
+                case Multiplying:
+                    loop.pos_ += dt * loop.rate_;
+                    break;
+                case Off:
+                    break;
+                default:
+                    if (loop.length_ > 0.0)
+                    {
+                        loop.pos_ = std::fmod(loop.pos_ + dt * loop.rate_, loop.length_);
+                    }
+                    break;
+            }
+        }
+    }
+
+    //==============================================================================
+    void addClient(const String& url)
+    {
+        clients_.addIfNotAlreadyThere(url);
+    }
+
+    // sends a message to an osc.udp://host:port/ url, keeping one sender per url
+    template <typename... Args>
+    void reply(const String& url, const String& path, Args&&... args)
+    {
+        OSCSender* sender = senders_[url];
+        if (sender == nullptr)
+        {
+            String hostPort = url.fromFirstOccurrenceOf("://", false, false).upToFirstOccurrenceOf("/", false, false);
+            sender = new OSCSender();
+            if (!sender->connect(hostPort.upToLastOccurrenceOf(":", false, false),
+                                 hostPort.fromLastOccurrenceOf(":", false, false).getIntValue()))
+            {
+                delete sender;
+                return;
+            }
+            senders_.set(url, sender);
+            ownedSenders_.add(sender);
+        }
+        sender->send(path, std::forward<Args>(args)...);
+    }
+
+    static constexpr const char* engineVersion = "1.7.3";
+
+    CriticalSection lock_;
+    OSCReceiver receiver_ { "fake sooperlooper osc" };
+    Array<FakeLoop> loops_;
+    Array<Registration> registrations_;
+    StringArray clients_;
+    HashMap<String, OSCSender*> senders_;
+    OwnedArray<OSCSender> ownedSenders_;
+    String hostUrl_;
+    int selectedLoop_ = 0;
+    int engineId_;
+    int floodRate_ = 0;
+    bool sync_ = true;
+    double now_ = 0.0; // seconds since start
+
+    JUCE_DECLARE_NON_COPYABLE(FakeSooperLooper)
+};
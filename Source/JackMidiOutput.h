@@ -0,0 +1,264 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_JACK
+ #include <dlfcn.h>
+ #include <jack/jack.h>
+ #include <jack/midiport.h>
+#endif
+
+/*
+ ==============================================================================
+ A JACK client with one MIDI output port, for sending commands straight into
+ SooperLooper's JACK MIDI input without the ALSA sequencer bridge.
+
+ send() stamps each message with the JACK frame at which the pedal arrived and
+ hands it to the process callback through a lock-free queue. The callback
+ writes it one period later at the same offset within the cycle, so the
+ delivery latency is constant instead of depending on when the cycle started.
+
+ libjack is loaded at runtime like JUCE's own JACK support does, so the
+ binary still runs where JACK isn't installed.
+ ==============================================================================
+ */
+class JackMidiOutput
+{
+public:
+    JackMidiOutput() : fifo_(queueSize) {}
+
+    ~JackMidiOutput()
+    {
+        close();
+    }
+
+#if JUCE_JACK
+    bool open(const String& clientName, const String& destination)
+    {
+        close();
+
+        if (!loadJack())
+        {
+            std::cerr << "Couldn't load libjack" << std::endl;
+            return false;
+        }
+
+        jack_status_t status;
+        client_ = jack_.client_open(clientName.toRawUTF8(), JackNoStartServer, &status);
+        if (client_ == nullptr)
+        {
+            std::cerr << "Couldn't connect to the JACK server" << std::endl;
+            return false;
+        }
+
+        port_ = jack_.port_register(client_, "commands", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+        sampleRate_ = (double) jack_.get_sample_rate(client_);
+        fifo_.reset();
+        jack_.set_process_callback(client_, processCallback, this);
+
+        if (port_ == nullptr || jack_.activate(client_) != 0)
+        {
+            std::cerr << "Couldn't activate the JACK MIDI output" << std::endl;
+            close();
+            return false;
+        }
+
+        if (destination.isNotEmpty()
+            && jack_.connect(client_, jack_.port_name(port_), destination.toRawUTF8()) != 0)
+        {
+            std::cerr << "Couldn't connect JACK MIDI output to " << destination << std::endl;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (client_ != nullptr)
+        {
+            jack_.deactivate(client_);
+            jack_.client_close(client_);
+            client_ = nullptr;
+            port_ = nullptr;
+        }
+    }
+
+    bool isOpen() const
+    {
+        return client_ != nullptr;
+    }
+
+    // Queues a short message that arrived at arrivalMs (a Time::getMillisecondCounterHiRes()
+    // value). Returns false if the queue is full. Safe to call from any thread.
+    bool send(const MidiMessage& message, double arrivalMs, int extraFrames = 0)
+    {
+        if (client_ == nullptr || message.getRawDataSize() > 3)
+        {
+            return false;
+        }
+
+        // jack_frame_time() is the frame now, walk it back to the arrival
+        double ageFrames = jmax(0.0, Time::getMillisecondCounterHiRes() - arrivalMs) * 0.001 * sampleRate_;
+        Event event;
+        event.frame_ = jack_.frame_time(client_) - (jack_nframes_t) ageFrames + (jack_nframes_t) extraFrames;
+        event.size_ = (uint8) message.getRawDataSize();
+        memcpy(event.data_, message.getRawData(), event.size_);
+
+        const SpinLock::ScopedLockType sl(writeLock_);
+        int start1, size1, start2, size2;
+        fifo_.prepareToWrite(1, start1, size1, start2, size2);
+        if (size1 + size2 == 0)
+        {
+            drops_++;
+            return false;
+        }
+        events_[size1 > 0 ? start1 : start2] = event;
+        fifo_.finishedWrite(1);
+        return true;
+    }
+
+    int64 getDropCount() const
+    {
+        return drops_;
+    }
+
+private:
+    struct JackFunctions
+    {
+        jack_client_t* (*client_open) (const char*, jack_options_t, jack_status_t*, ...);
+        int (*client_close) (jack_client_t*);
+        int (*activate) (jack_client_t*);
+        int (*deactivate) (jack_client_t*);
+        jack_port_t* (*port_register) (jack_client_t*, const char*, const char*, unsigned long, unsigned long);
+        const char* (*port_name) (const jack_port_t*);
+        int (*connect) (jack_client_t*, const char*, const char*);
+        int (*set_process_callback) (jack_client_t*, JackProcessCallback, void*);
+        jack_nframes_t (*get_sample_rate) (jack_client_t*);
+        jack_nframes_t (*frame_time) (const jack_client_t*);
+        jack_nframes_t (*last_frame_time) (const jack_client_t*);
+        void* (*port_get_buffer) (jack_port_t*, jack_nframes_t);
+        void (*midi_clear_buffer) (void*);
+        int (*midi_event_write) (void*, jack_nframes_t, const jack_midi_data_t*, size_t);
+    };
+
+    template <typename Fn>
+    static bool resolve(void* library, const char* name, Fn& fn)
+    {
+        fn = reinterpret_cast<Fn> (dlsym(library, name));
+        return fn != nullptr;
+    }
+
+    bool loadJack()
+    {
+        if (library_ == nullptr)
+        {
+            library_ = dlopen("libjack.so.0", RTLD_LAZY);
+        }
+
+        return library_ != nullptr
+            && resolve(library_, "jack_client_open", jack_.client_open)
+            && resolve(library_, "jack_client_close", jack_.client_close)
+            && resolve(library_, "jack_activate", jack_.activate)
+            && resolve(library_, "jack_deactivate", jack_.deactivate)
+            && resolve(library_, "jack_port_register", jack_.port_register)
+            && resolve(library_, "jack_port_name", jack_.port_name)
+            && resolve(library_, "jack_connect", jack_.connect)
+            && resolve(library_, "jack_set_process_callback", jack_.set_process_callback)
+            && resolve(library_, "jack_get_sample_rate", jack_.get_sample_rate)
+            && resolve(library_, "jack_frame_time", jack_.frame_time)
+            && resolve(library_, "jack_last_frame_time", jack_.last_frame_time)
+            && resolve(library_, "jack_port_get_buffer", jack_.port_get_buffer)
+            && resolve(library_, "jack_midi_clear_buffer", jack_.midi_clear_buffer)
+            && resolve(library_, "jack_midi_event_write", jack_.midi_event_write);
+    }
+
+    static int processCallback(jack_nframes_t frames, void* arg)
+    {
+        static_cast<JackMidiOutput*>(arg)->process(frames);
+        return 0;
+    }
+
+    // JACK's realtime thread: no locks, no allocation
+    void process(jack_nframes_t frames)
+    {
+        void* buffer = jack_.port_get_buffer(port_, frames);
+        jack_.midi_clear_buffer(buffer);
+
+        // events from the previous period land one period later, at the same offset
+        jack_nframes_t cycleStart = jack_.last_frame_time(client_);
+        jack_nframes_t lastOffset = 0;
+
+        while (fifo_.getNumReady() > 0)
+        {
+            int start1, size1, start2, size2;
+            fifo_.prepareToRead(1, start1, size1, start2, size2);
+            const Event& event = events_[size1 > 0 ? start1 : start2];
+
+            int offset = (int) (event.frame_ + frames - cycleStart);
+            if (offset >= (int) frames)
+            {
+                break; // arrived during this cycle, goes out in the next one
+            }
+
+            // late events go out first thing, and offsets can't go backwards
+            jack_nframes_t at = jmax(lastOffset, (jack_nframes_t) jmax(0, offset));
+            jack_.midi_event_write(buffer, at, event.data_, event.size_);
+            lastOffset = at;
+            fifo_.finishedRead(1);
+        }
+    }
+
+    void* library_ = nullptr;
+    JackFunctions jack_ {};
+    jack_client_t* client_ = nullptr;
+    jack_port_t* port_ = nullptr;
+    double sampleRate_ = 48000.0;
+    SpinLock writeLock_;  // commands come from the controller thread, the lock keeps send() safe from others
+#else
+    bool open(const String&, const String&)
+    {
+        std::cerr << "This build has no JACK support" << std::endl;
+        return false;
+    }
+
+    void close() {}
+    bool isOpen() const { return false; }
+    bool send(const MidiMessage&, double, int = 0) { return false; }
+    int64 getDropCount() const { return drops_; }
+
+private:
+    typedef uint32 jack_nframes_t;
+#endif
+
+    struct Event
+    {
+        jack_nframes_t frame_;
+        uint8 size_;
+        uint8 data_[3];
+    };
+
+    static const int queueSize = 256;
+
+    AbstractFifo fifo_;
+    Event events_[queueSize];
+    std::atomic<int64> drops_ { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(JackMidiOutput)
+};
@@ -0,0 +1,175 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LooperCore.h"
+#include "RawMidiOutput.h"
+
+/*
+ ==============================================================================
+ Schedules FCB1010 LED messages onto the DIN link.
+
+ Each LED (and the display) has a single slot holding its latest pending
+ message, so an update that is superseded before it reaches the wire is
+ simply replaced. The writer pulls the most important, oldest slot first,
+ within a byte budget that keeps the link below its ~1000 messages/s.
+ ==============================================================================
+ */
+class LedScheduler : public RawMidiOutput::Source
+{
+public:
+    static const int defaultBytesPerSecond = 3000;
+
+    LedScheduler(RawMidiOutput& output, int bytesPerSecond = defaultBytesPerSecond)
+    : output_(output), bytesPerSecond_(bytesPerSecond)
+    {
+        output_.setSource(this);
+    }
+
+    ~LedScheduler()
+    {
+        output_.setSource(nullptr);
+    }
+
+    // Queues a 3 byte LED or display CC, safe to call from any thread.
+    void post(LedPriority priority, const unsigned char* data, int size)
+    {
+        jassert(size == messageSize);
+        if (size != messageSize)
+        {
+            return;
+        }
+
+        {
+            const SpinLock::ScopedLockType sl(lock_);
+            Slot& slot = slots_[slotFor(data)];
+            if (slot.pending_)
+            {
+                collapsed_++;
+                slot.priority_ = jmin(slot.priority_, (int) priority);
+            }
+            else
+            {
+                slot.pending_ = true;
+                slot.priority_ = priority;
+                slot.sequence_ = sequence_++;
+            }
+            memcpy(slot.data_, data, messageSize);
+        }
+
+        output_.wake();
+    }
+
+    // updates replaced before they were sent
+    int64 getCollapsedCount() const
+    {
+        return collapsed_;
+    }
+
+    int pull(char* dest, int maxBytes, uint32 nowMs) override
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        refill(nowMs);
+
+        int size = 0;
+        while (maxBytes - size >= messageSize && budget_ >= messageSize)
+        {
+            int next = nextSlot();
+            if (next < 0)
+            {
+                break;
+            }
+
+            Slot& slot = slots_[next];
+            memcpy(dest + size, slot.data_, messageSize);
+            slot.pending_ = false;
+            size += messageSize;
+            budget_ -= messageSize;
+        }
+        return size;
+    }
+
+    int msUntilReady(uint32 nowMs) override
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        if (nextSlot() < 0)
+        {
+            return 100;
+        }
+
+        refill(nowMs);
+        return budget_ >= messageSize ? 0 : (int) std::ceil((messageSize - budget_) * 1000.0 / bytesPerSecond_);
+    }
+
+private:
+    static const int messageSize = 3;
+    static const int displaySlot = 128;
+    static const int numSlots = 129;
+
+    struct Slot
+    {
+        bool pending_ = false;
+        int priority_ = 0;
+        uint32 sequence_ = 0;
+        unsigned char data_[messageSize];
+    };
+
+    // LED on and off share the LED's slot, the display has its own
+    static int slotFor(const unsigned char* data)
+    {
+        return data[1] == 106 || data[1] == 107 ? (data[2] & 0x7f) : displaySlot;
+    }
+
+    int nextSlot() const
+    {
+        int best = -1;
+        for (auto i = 0; i < numSlots; i++)
+        {
+            const Slot& slot = slots_[i];
+            if (slot.pending_ && (best < 0 || slot.priority_ < slots_[best].priority_
+                                  || (slot.priority_ == slots_[best].priority_
+                                      && (int) (slot.sequence_ - slots_[best].sequence_) < 0)))
+            {
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    // token bucket, allowing a burst of a few messages after a quiet spell
+    void refill(uint32 nowMs)
+    {
+        budget_ = jmin((double) maxBurst, budget_ + (nowMs - lastRefill_) * bytesPerSecond_ * 0.001);
+        lastRefill_ = nowMs;
+    }
+
+    static const int maxBurst = 8 * messageSize;
+
+    RawMidiOutput& output_;
+    int bytesPerSecond_;
+    SpinLock lock_;
+    Slot slots_[numSlots];
+    uint32 sequence_ = 0;
+    double budget_ = maxBurst;
+    uint32 lastRefill_ = Time::getMillisecondCounter();
+    std::atomic<int64> collapsed_ { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(LedScheduler)
+};
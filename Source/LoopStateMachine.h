@@ -0,0 +1,226 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// SooperLooper's loop states, as reported in the "state" control
+enum LoopStates
+{
+    Unknown = -1,
+    Off = 0,
+    WaitStart = 1,
+    Recording = 2,
+    WaitStop = 3,
+    Playing = 4,
+    Overdubbing = 5,
+    Multiplying = 6,
+    Inserting = 7,
+    Replacing = 8,
+    Delay = 9,
+    Muted = 10,
+    Scratching = 11,
+    OneShot = 12,
+    Substitute = 13,
+    Paused = 14,
+    Last = 20
+};
+
+// the SooperLooper commands loop4r sends to loops
+enum LoopCommand
+{
+    CmdRecord,
+    CmdOverdub,
+    CmdMultiply,
+    CmdInsert,
+    CmdReplace,
+    CmdSubstitute,
+    CmdMute,
+    CmdMuteOn,
+    CmdMuteOff,
+    CmdTrigger,
+    CmdUndo,
+    CmdUndoAll,
+    NumLoopCommands
+};
+
+static const char* const loopCommandNames[NumLoopCommands] =
+{
+    "record", "overdub", "multiply", "insert", "replace", "substitute",
+    "mute", "mute_on", "mute_off", "trigger", "undo", "undo_all"
+};
+
+enum CommandEdge
+{
+    EdgeDown,
+    EdgeUp,
+    NumCommandEdges
+};
+
+/*
+ ==============================================================================
+ A model of SooperLooper's loop state machine, as far as loop4r's commands go.
+
+ The rules in nextLoopState() are evaluated once, at compile time, into a
+ lookup table, so every query below is a single array read. States past
+ Paused aren't modeled; queries about them answer Unknown or "plausible".
+ ==============================================================================
+ */
+namespace LoopStateMachine
+{
+    static const int numStates = Paused + 1;
+
+    // SooperLooper acts on the press, releases only matter for sustained commands
+    constexpr LoopStates nextLoopState(LoopStates state, LoopCommand command, CommandEdge edge)
+    {
+        if (edge == EdgeUp)
+        {
+            return state;
+        }
+
+        switch (command)
+        {
+            case CmdRecord:
+                return state == Recording ? Playing
+                     : state == WaitStart ? Off
+                     : state == WaitStop ? WaitStop
+                     : Recording;
+
+            case CmdOverdub:
+            case CmdMultiply:
+            case CmdInsert:
+            case CmdReplace:
+            case CmdSubstitute:
+            {
+                LoopStates active = command == CmdOverdub ? Overdubbing
+                                  : command == CmdMultiply ? Multiplying
+                                  : command == CmdInsert ? Inserting
+                                  : command == CmdReplace ? Replacing
+                                  : Substitute;
+                return state == active ? Playing
+                     : state == Off || state == WaitStart ? state
+                     : active;
+            }
+
+            case CmdMute:
+                return state == Muted ? Playing
+                     : state == Off || state == WaitStart || state == Recording ? state
+                     : Muted;
+
+            case CmdMuteOn:
+                return state == Off || state == WaitStart || state == Recording ? state : Muted;
+
+            case CmdMuteOff:
+                return state == Muted ? Playing : state;
+
+            case CmdTrigger:
+                return state == Off || state == WaitStart ? state : Playing;
+
+            case CmdUndo:
+                return state == Recording ? Off
+                     : state == Off || state == Muted || state == Paused ? state
+                     : Playing;
+
+            case CmdUndoAll:
+                return Off;
+
+            default:
+                return state;
+        }
+    }
+
+    // changes that happen without a command: waits ending at the sync point
+    constexpr LoopStates spontaneousState(LoopStates state)
+    {
+        return state == WaitStart ? Recording : state == WaitStop ? Playing : state;
+    }
+
+    // with sync on, the engine waits for the sync point before getting there
+    constexpr LoopStates syncWaitState(LoopStates state)
+    {
+        return state == Recording ? WaitStart : state == Playing ? WaitStop : state;
+    }
+
+    struct Table
+    {
+        uint8 next_[numStates][NumLoopCommands][NumCommandEdges];
+        uint16 reachable_[numStates];     // bit per state reachable in one step
+        uint8 recordPedal_[numStates];    // LoopCommand the record pedal sends
+    };
+
+    // states entered through commands loop4r doesn't send, so anything goes
+    static const uint16 unmodeled = (1u << Delay) | (1u << Scratching) | (1u << OneShot) | (1u << Paused);
+
+    constexpr Table buildTable()
+    {
+        Table table {};
+
+        for (int s = 0; s < numStates; s++)
+        {
+            LoopStates state = static_cast<LoopStates>(s);
+            table.reachable_[s] = (uint16) ((1u << s) | (1u << spontaneousState(state)) | unmodeled);
+            if (unmodeled & (1u << s))
+            {
+                table.reachable_[s] = 0xffff;
+            }
+            for (int c = 0; c < NumLoopCommands; c++)
+            {
+                for (int e = 0; e < NumCommandEdges; e++)
+                {
+                    LoopStates next = nextLoopState(state, static_cast<LoopCommand>(c), static_cast<CommandEdge>(e));
+                    table.next_[s][c][e] = (uint8) next;
+                    table.reachable_[s] = (uint16) (table.reachable_[s] | (1u << next) | (1u << syncWaitState(next)));
+                }
+            }
+
+            // record ends a recording or starts one on an empty loop,
+            // otherwise the pedal overdubs
+            bool record = state == Recording || state == WaitStart
+                       || nextLoopState(state, CmdOverdub, EdgeDown) == state;
+            table.recordPedal_[s] = (uint8) (record ? CmdRecord : CmdOverdub);
+        }
+        return table;
+    }
+
+    constexpr Table table = buildTable();
+
+    inline bool isModeled(LoopStates state)
+    {
+        return state >= Off && state < numStates;
+    }
+
+    // the state a command leads to, Unknown for states that aren't modeled
+    inline LoopStates transition(LoopStates state, LoopCommand command, CommandEdge edge)
+    {
+        return isModeled(state) ? static_cast<LoopStates>(table.next_[state][command][edge]) : Unknown;
+    }
+
+    // false if the engine can't get from one state to the other with the
+    // modeled commands, e.g. Off straight to Overdubbing
+    inline bool isPlausible(LoopStates from, LoopStates to)
+    {
+        return !isModeled(from) || !isModeled(to) || (table.reachable_[from] & (1u << to)) != 0;
+    }
+
+    // record or overdub, depending on the loop's state
+    inline LoopCommand recordPedalCommand(LoopStates state)
+    {
+        return isModeled(state) ? static_cast<LoopCommand>(table.recordPedal_[state]) : CmdRecord;
+    }
+}
@@ -0,0 +1,1103 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LooperCore.h"
+#include "Trace.h"
+
+// SooperLooper may wait for a sync point first, which still counts as the prediction
+static bool confirmsPrediction(LoopStates predicted, LoopStates actual)
+{
+    return actual == predicted
+        || (predicted == Recording && actual == WaitStart)
+        || (predicted == Playing && actual == WaitStop);
+}
+
+LooperCore::LooperCore(LooperOutput& output, const LooperClock& clock)
+: output_(output), clock_(clock)
+{
+    for (auto i=0; i<NUM_LEDS; i++)
+    {
+        leds_.add({i, false, TIMER_OFF, Dark});
+    }
+}
+
+int LooperCore::process(LooperInput& input)
+{
+    int count = 0;
+    LooperEvent event;
+    while (input.next(event))
+    {
+        handle(event);
+        count++;
+    }
+    return count;
+}
+
+void LooperCore::handle(const LooperEvent& event)
+{
+    switch (event.type_)
+    {
+        case LooperEvent::Pedal:
+            pedal(event.index_, event.value_ != 0, event.timeMs_);
+            break;
+        case LooperEvent::LoopState:
+            engineLoopState(event.index_, static_cast<LoopStates>(event.value_));
+            break;
+        case LooperEvent::SelectedLoop:
+            engineSelectedLoop(event.value_);
+            break;
+        case LooperEvent::LoopCount:
+            resetLoops(event.value_);
+            break;
+        case LooperEvent::Tick:
+            expirePredictions();
+            stepBlinks();
+            break;
+    }
+}
+
+//==============================================================================
+void LooperCore::pedal(int pedalIdx, bool down, double pressedAt)
+{
+    LOOP4R_TRACE_SCOPE("LooperCore::pedal");
+    pressedAt_ = pressedAt;
+    switch (pedalIdx)
+    {
+        case TRACK1:
+        case TRACK2:
+        case TRACK3:
+        case TRACK4:
+            if (bank_ * BANK_SIZE + pedalIdx >= loops_.size())
+            {
+                break;
+            }
+            sendSelectTrack(bank_ * BANK_SIZE + pedalIdx);
+            if (mode_ == Rec)
+            {
+                sendRecordOrOverdubSelected(pedalIdx, down);
+            }
+            else
+            {
+                sendMuteSelected(down);
+            }
+            break;
+
+        case MULTIPLY:
+            if (mode_ == Rec)
+            {
+                sendSelected("multiply", CmdMultiply, down);
+            }
+            break;
+
+        case CLEAR:
+            if (handleBankPedal(pedalIdx, down))
+            {
+                break;
+            }
+            if (mode_ == Rec)
+            {
+                send(-3, "undo_all", down);
+                if (down)
+                    predictSelected(CmdUndoAll);
+                if (log_)
+                    std::cerr << "clear selected" << std::endl;
+            }
+            else
+            {
+                sendClearAll(down);
+            }
+            break;
+
+        case REPLACE:
+            if (mode_ == Rec)
+            {
+                sendSelected("replace", CmdReplace, down);
+            }
+            break;
+
+        case INSERT:
+            if (mode_ == Rec)
+            {
+                sendSelected("insert", CmdInsert, down);
+            }
+            break;
+
+        case SUBSTITUTE:
+            if (mode_ == Rec)
+            {
+                sendSelected("substitute", CmdSubstitute, down);
+            }
+            break;
+
+        case MUTE:
+            if (handleBankPedal(pedalIdx, down))
+            {
+                break;
+            }
+            if (mode_ == Rec)
+            {
+                sendMuteSelected(down);
+            }
+            else if (down)
+            {
+                if (allMuted())
+                {
+                    sendTriggerAll();
+                    sendMuteOffAll(); // unmute any empty
+                                      // tracks that didn't trigger
+                }
+                else
+                {
+                    sendMuteAll();
+                }
+            }
+            break;
+
+        case UNDO:
+            if (mode_ == Rec)
+            {
+                sendUndoSelected(down);
+            }
+            break;
+
+        case RECORD:
+            // holding RECORD turns UP/DOWN into bank paging, in which
+            // case releasing it doesn't toggle the mode
+            if (down)
+            {
+                recordHeld_ = true;
+                bankPaged_ = false;
+            }
+            else
+            {
+                recordHeld_ = false;
+                if (!bankPaged_)
+                {
+                    mode_ = mode_ == Rec ? Play : Rec;
+                }
+            }
+
+            if (mode_ == Rec)
+            {
+                ledOn(RECORD);
+            }
+            else
+            {
+                ledOff(RECORD);
+            }
+            break;
+
+        default:
+            break;
+    }
+    updateLoops();
+}
+
+// Holding a track pedal clears its loop, after whatever its press started
+void LooperCore::pedalLongPress(int pedalIdx, double pressedAt)
+{
+    int loop = bank_ * BANK_SIZE + pedalIdx;
+    if (pedalIdx > TRACK4 || loop >= loops_.size())
+    {
+        return;
+    }
+
+    pressedAt_ = pressedAt;
+    hit(loop, "undo_all");
+    applyPrediction(loop, CmdUndoAll);
+    if (log_)
+        std::cerr << "clear " << loop << std::endl;
+}
+
+// Tapping UNDO twice undoes everything on the selected loop
+void LooperCore::pedalDoubleTap(int pedalIdx, double pressedAt)
+{
+    if (pedalIdx != UNDO || mode_ != Rec)
+    {
+        return;
+    }
+
+    pressedAt_ = pressedAt;
+    hit(-3, "undo_all");
+    predictSelected(CmdUndoAll);
+    if (log_)
+        std::cerr << "undo all selected" << std::endl;
+}
+
+// UP/DOWN page through the loop banks while RECORD is held down.
+// Returns true if the pedal event was consumed for paging.
+bool LooperCore::handleBankPedal(int pedalIdx, bool down)
+{
+    if (pagingPedal_ == pedalIdx && !down)
+    {
+        // swallow the release of a paging press
+        pagingPedal_ = -1;
+        return true;
+    }
+
+    if (recordHeld_ && down)
+    {
+        pagingPedal_ = pedalIdx;
+        bankPaged_ = true;
+        showBank(pedalIdx == UP ? bank_ + 1 : bank_ - 1);
+        return true;
+    }
+
+    return false;
+}
+
+bool LooperCore::allMuted() const
+{
+    for (auto&& loop : loops_)
+    {
+        if (loop.state_ != Unknown && loop.state_ != Off &&
+            loop.state_ != Muted && loop.state_ != Paused)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//==============================================================================
+// note and noteLoop pick another .slb binding than the command's own
+void LooperCore::send(int loop, const char* command, bool down, const char* note, int noteLoop)
+{
+    output_.sendCommand({loop, command, down ? CommandDown : CommandUp, note, noteLoop, pressedAt_});
+}
+
+void LooperCore::hit(int loop, const char* command)
+{
+    output_.sendCommand({loop, command, CommandHit, nullptr, 0, pressedAt_});
+}
+
+void LooperCore::sendSelectTrack(int track)
+{
+    selectedLoop_ = track;
+    output_.selectLoop(track);
+    if (log_)
+        std::cerr << "select track" << track << std::endl;
+}
+
+void LooperCore::sendSelected(const char* command, LoopCommand prediction, bool down)
+{
+    send(-3, command, down);
+    if (down)
+        predictSelected(prediction);
+    if (log_)
+        std::cerr << command << " " << selectedLoop_ << std::endl;
+}
+
+void LooperCore::sendClearAll(bool down)
+{
+    send(-1, "undo_all", down);
+    if (down)
+        predictAll(CmdUndoAll);
+    if (log_)
+        std::cerr << "clear all" << std::endl;
+}
+
+void LooperCore::sendMuteAll()
+{
+    hit(-1, "mute_on");
+    predictAll(CmdMuteOn);
+    if (log_)
+        std::cerr << "mute all" << std::endl;
+}
+
+void LooperCore::sendMuteOffAll()
+{
+    hit(-1, "mute_off");
+    predictAll(CmdMuteOff);
+    if (log_)
+        std::cerr << "mute off all" << std::endl;
+}
+
+void LooperCore::sendMuteSelected(bool down)
+{
+    // the .slb binds the track pedals' mute to mute_trigger
+    send(-3, "mute", down, "mute_trigger", selectedLoop_);
+    if (down)
+        predictSelected(CmdMute);
+    if (log_)
+        std::cerr << "mute " << selectedLoop_ << std::endl;
+}
+
+void LooperCore::sendRecordOrOverdubSelected(int pedalIdx, bool down)
+{
+    if (!isPositiveAndBelow(selectedLoop_, loops_.size()))
+    {
+        return;
+    }
+    // the press's prediction has already moved the loop on, so the release
+    // has to repeat the command that was pressed
+    if (down)
+        trackCommands_[pedalIdx] = LoopStateMachine::recordPedalCommand(loops_.getReference(selectedLoop_).state_);
+    LoopCommand command = trackCommands_[pedalIdx];
+    send(-3, loopCommandNames[command], down, "record_or_overdub_excl", selectedLoop_);
+    if (down)
+        predictSelected(command);
+    if (log_)
+        std::cerr << "record selected" << std::endl;
+}
+
+void LooperCore::sendTriggerAll()
+{
+    hit(-1, "trigger");
+    predictAll(CmdTrigger);
+    if (log_)
+        std::cerr << "trigger all" << std::endl;
+}
+
+void LooperCore::sendUndoSelected(bool down)
+{
+    send(-3, "undo", down);
+    if (log_)
+        std::cerr << "undo selected" << std::endl;
+}
+
+//==============================================================================
+void LooperCore::predictSelected(LoopCommand command)
+{
+    applyPrediction(selectedLoop_, command);
+}
+
+void LooperCore::predictAll(LoopCommand command)
+{
+    for (auto i = 0; i < loops_.size(); i++)
+    {
+        applyPrediction(i, command);
+    }
+}
+
+// Shows the state a command should lead to without waiting for the engine.
+void LooperCore::applyPrediction(int index, LoopCommand command)
+{
+    if (!isPositiveAndBelow(index, loops_.size()))
+    {
+        return;
+    }
+
+    Loop& loop = loops_.getReference(index);
+    LoopStates next = LoopStateMachine::transition(loop.state_, command, EdgeDown);
+    if (next == Unknown || next == loop.state_)
+    {
+        return;
+    }
+
+    loop.predicted_ = next;
+    loop.predictedAt_ = clock_.nowMs();
+    loop.pressedAt_ = pressedAt_;
+    predictions_++;
+    updateLoopLedState(loop, next);
+}
+
+void LooperCore::engineLoopState(int index, LoopStates state)
+{
+    if (isPositiveAndBelow(index, loops_.size()))
+    {
+        reconcileLoopState(loops_.getReference(index), state);
+    }
+}
+
+// Applies a state reported by the engine, settling any prediction for the loop.
+// Only loops reported often are checked for impossible changes: a hidden or
+// idle loop may have gone through states in between, e.g. Off, Recording and
+// Playing arriving as Off and Playing.
+void LooperCore::reconcileLoopState(Loop& loop, LoopStates actual)
+{
+    bool consecutive = loop.updateInterval_ > 0.0 && loop.updateInterval_ <= PLAUSIBILITY_INTERVAL;
+    if (consecutive && !LoopStateMachine::isPlausible(loop.confirmed_, actual))
+    {
+        implausibleTransitions_++;
+        if (log_)
+            std::cerr << "Suspicious state change for loop " << loop.index_ << ": " << (int) loop.confirmed_
+                      << " -> " << (int) actual << " isn't possible with the known commands" << std::endl;
+    }
+    loop.confirmed_ = actual;
+    if (loop.predicted_ != Unknown)
+    {
+        if (confirmsPrediction(loop.predicted_, actual))
+        {
+            // pedal to engine state, including the auto update interval
+            output_.predictionConfirmed(loop.index_, clock_.nowMs() - loop.pressedAt_);
+        }
+        else
+        {
+            mispredictions_++;
+            if (log_)
+                std::cerr << "Mispredicted loop " << loop.index_ << " state " << (int) loop.predicted_
+                          << ", engine reports " << (int) actual << " (" << mispredictions_ << " of "
+                          << predictions_ << " predictions)" << std::endl;
+        }
+        loop.predicted_ = Unknown;
+    }
+    updateLoopLedState(loop, actual);
+}
+
+void LooperCore::setUpdateInterval(int loop, double ms)
+{
+    if (isPositiveAndBelow(loop, loops_.size()))
+    {
+        loops_.getReference(loop).updateInterval_ = ms;
+    }
+}
+
+// A loop in a hidden bank may only be reported every few seconds, which
+// is no reason to give up on its prediction.
+double LooperCore::predictionTimeout(const Loop& loop) const
+{
+    return PREDICTION_TIMEOUT + loop.updateInterval_ + roundTripMs_;
+}
+
+// Reverts predictions the engine never confirmed, e.g. a command it ignored.
+void LooperCore::expirePredictions()
+{
+    double now = clock_.nowMs();
+    for (auto&& loop : loops_)
+    {
+        if (loop.predicted_ != Unknown && now - loop.predictedAt_ > predictionTimeout(loop))
+        {
+            mispredictions_++;
+            if (log_)
+                std::cerr << "Loop " << loop.index_ << " never reached predicted state " << (int) loop.predicted_
+                          << ", reverting (" << mispredictions_ << " of " << predictions_ << " predictions)" << std::endl;
+            loop.predicted_ = Unknown;
+            updateLoopLedState(loop, loop.confirmed_ != Unknown ? loop.confirmed_ : Off);
+        }
+    }
+}
+
+void LooperCore::engineSelectedLoop(int loop)
+{
+    selectedLoop_ = loop;
+    output_.showSelectedLoop(loop);
+    if (selectedLoop_ >= 0)
+    {
+        // follow the selection if it moved to another bank
+        showBank(bankOf(selectedLoop_));
+    }
+}
+
+void LooperCore::resetLoops(int count)
+{
+    loops_.clear();
+    addLoops(count);
+}
+
+void LooperCore::addLoops(int count)
+{
+    for (auto i = loops_.size(); i < count; i++)
+    {
+        loops_.add({i, Off, true, Dark, clock_.nowMs()});
+    }
+    showBank(bank_, true);
+}
+
+//==============================================================================
+void LooperCore::saveState(LooperSnapshot& state) const
+{
+    zerostruct(state);
+    state.mode_ = mode_;
+    state.selectedLoop_ = selectedLoop_;
+    state.bank_ = bank_;
+    state.loopCount_ = jmin(loops_.size(), LooperSnapshot::maxLoops);
+    for (auto i = 0; i < state.loopCount_; i++)
+    {
+        state.loopStates_[i] = (int8) loops_.getReference(i).state_;
+    }
+    for (auto i = 0; i < NUM_LEDS; i++)
+    {
+        state.ledOn_[i] = leds_.getReference(i).on_ ? 1 : 0;
+        state.ledStates_[i] = (uint8) leds_.getReference(i).state_;
+    }
+}
+
+// The engine isn't heard from yet, so the loops count as unconfirmed and
+// its first reports settle them like any other update. The snapshot comes
+// from a file, so anything out of range falls back to no selection and Off.
+void LooperCore::restoreState(const LooperSnapshot& state)
+{
+    mode_ = state.mode_ == Rec ? Rec : Play;
+    loops_.clear();
+    for (auto i = 0; i < jlimit(0, LooperSnapshot::maxLoops, (int) state.loopCount_); i++)
+    {
+        loops_.add({i, Off, true, Dark, clock_.nowMs()});
+    }
+    selectedLoop_ = isPositiveAndBelow((int) state.selectedLoop_, loops_.size()) ? (int) state.selectedLoop_ : -1;
+    bank_ = jlimit(0, bankCount() - 1, (int) state.bank_);
+
+    // the LEDs are written once below, as they were saved
+    for (auto&& loop : loops_)
+    {
+        auto loopState = static_cast<LoopStates>(state.loopStates_[loop.index_]);
+        bool valid = LoopStateMachine::isModeled(loopState) || loopState == Last;
+        updateLoopLedState(loop, valid ? loopState : Off, false);
+    }
+    for (auto&& led : leds_)
+    {
+        led.on_ = state.ledOn_[led.index_] != 0;
+        led.state_ = static_cast<LedStates>(jlimit(0, (int) FastBlink, (int) state.ledStates_[led.index_]));
+        led.timer_ = ledTimer(led.state_);
+    }
+    refreshLeds();
+}
+
+void LooperCore::updateLoops()
+{
+    for (auto&& loop : loops_)
+    {
+        updateLoopLedState(loop, loop.state_);
+    }
+}
+
+void LooperCore::updateLoopLedState(Loop& loop, LoopStates newState, bool show)
+{
+    LOOP4R_TRACE_SCOPE("LooperCore::updateLoopLedState");
+    if (log_)
+        std::cerr << "updating " << loop.index_ << " state: ";
+    const char* name = "default";
+    switch (newState)
+    {
+        case Unknown:
+        case Off:
+            name = "Off";
+            loop.ledState_ = Dark;
+            break;
+        case WaitStart:
+        case WaitStop:
+            name = "Wait Start/Stop";
+            loop.ledState_ = FastBlink;
+            break;
+        case Recording:
+            name = "Recording";
+            loop.ledState_ = Light;
+            break;
+        case Overdubbing:
+            name = "Overdubbing";
+            loop.ledState_ = Light;
+            break;
+        case Inserting:
+            name = "Inserting";
+            loop.ledState_ = FastBlink;
+            break;
+        case Replacing:
+            name = "Replacing";
+            loop.ledState_ = FastBlink;
+            break;
+        case Substitute:
+            name = "Substituting";
+            loop.ledState_ = FastBlink;
+            break;
+        case Multiplying:
+            name = "Multiplying";
+            loop.ledState_ = FastBlink;
+            break;
+        case Delay:
+            name = "Delay";
+            loop.ledState_ = Light;
+            break;
+        case Scratching:
+            name = "Scratching";
+            loop.ledState_ = Light;
+            break;
+        case OneShot:
+            name = "Oneshot";
+            loop.ledState_ = Light;
+            break;
+        case Playing:
+            name = "Playing";
+            loop.ledState_ = mode_ == Play ? Light : Blink;
+            break;
+        case Muted:
+        case Paused:
+            name = "Muted/Paused";
+            loop.ledState_ = Blink;
+            break;
+        case Last:
+            name = "Last";
+            loop.ledState_ = Dark;
+            break;
+        default:
+            loop.ledState_ = Dark;
+            break;
+    }
+    if (log_)
+        std::cerr << name << std::endl;
+
+    LoopStates oldState = loop.state_;
+    loop.state_ = newState;
+    loop.empty_ = loop.state_ == Off;
+    if (newState != oldState)
+    {
+        loop.lastChange_ = clock_.nowMs();
+    }
+
+    if (show && isLoopVisible(loop))
+    {
+        // turn off any function led that is no longer active
+        int oldFunction = functionLed(oldState);
+        if (newState != oldState && oldFunction >= 0)
+        {
+            ledOff(oldFunction);
+        }
+        showLoopLed(loop);
+    }
+}
+
+// the function pedal whose led is lit while a loop is in the given state
+int LooperCore::functionLed(LoopStates state)
+{
+    switch (state)
+    {
+        case Multiplying:   return MULTIPLY;
+        case Replacing:     return REPLACE;
+        case Inserting:     return INSERT;
+        case Substitute:    return SUBSTITUTE;
+        default:            return -1;
+    }
+}
+
+int LooperCore::ledTimer(LedStates state)
+{
+    switch (state)
+    {
+        case Blink:         return TIMER_BLINK;
+        case FastBlink:     return TIMER_FASTBLINK;
+        default:            return TIMER_OFF;
+    }
+}
+
+//==============================================================================
+// Loop banks: the four track pedals show loops bank_*BANK_SIZE .. +BANK_SIZE-1.
+// Every loop keeps its own led state, only the visible ones are written out.
+
+// write a visible loop's state to its track led and function led
+void LooperCore::showLoopLed(const Loop& loop)
+{
+    int pedalIdx = loop.index_ % BANK_SIZE;
+    LED& led = leds_.getReference(pedalIdx);
+    led.state_ = loop.ledState_;
+    led.timer_ = ledTimer(loop.ledState_);
+    if (loop.ledState_ == Dark)
+    {
+        ledOff(pedalIdx);
+    }
+    else
+    {
+        ledOn(pedalIdx);
+    }
+
+    int function = functionLed(loop.state_);
+    if (function >= 0)
+    {
+        ledOn(function);
+    }
+}
+
+void LooperCore::showBank(int bank, bool force)
+{
+    bank = jlimit(0, bankCount() - 1, bank);
+    if (bank == bank_ && !force)
+    {
+        return;
+    }
+
+    int oldBank = bank_;
+    for (auto i = oldBank * BANK_SIZE; i < jmin(loops_.size(), (oldBank + 1) * BANK_SIZE); i++)
+    {
+        int function = functionLed(loops_.getReference(i).state_);
+        if (function >= 0)
+        {
+            ledOff(function);
+        }
+    }
+
+    bank_ = bank;
+    if (log_)
+        std::cerr << "bank " << bank_ + 1 << "/" << bankCount() << std::endl;
+
+    for (auto pedalIdx = 0; pedalIdx < BANK_SIZE; pedalIdx++)
+    {
+        int loopIndex = bank_ * BANK_SIZE + pedalIdx;
+        if (loopIndex < loops_.size())
+        {
+            showLoopLed(loops_.getReference(loopIndex));
+        }
+        else
+        {
+            LED& led = leds_.getReference(pedalIdx);
+            led.state_ = Dark;
+            led.timer_ = TIMER_OFF;
+            ledOff(pedalIdx);
+        }
+    }
+
+    if (oldBank != bank_)
+    {
+        output_.bankChanged(bank_);
+    }
+}
+
+//==============================================================================
+void LooperCore::ledOn(int pedalIdx, LedPriority priority)
+{
+    LED& led = leds_.getReference(pedalIdx);
+    led.on_ = true;
+    output_.writeLed(led, priority);
+}
+
+void LooperCore::ledOff(int pedalIdx, LedPriority priority)
+{
+    LED& led = leds_.getReference(pedalIdx);
+    led.on_ = false;
+    output_.writeLed(led, priority);
+}
+
+void LooperCore::refreshLeds()
+{
+    for (auto&& led : leds_)
+    {
+        output_.writeLed(led, LedStatePriority);
+    }
+}
+
+void LooperCore::stepBlinks()
+{
+    for (auto&& led : leds_)
+    {
+        if (led.state_ == Blink || led.state_ == FastBlink)
+        {
+            if (led.timer_ <= 0)
+            {
+                if (led.on_) {
+                    ledOff(led.index_, LedBlinkPriority);
+                }
+                else
+                {
+                    ledOn(led.index_, LedBlinkPriority);
+                }
+                led.timer_ = led.state_ == Blink ? TIMER_BLINK : TIMER_FASTBLINK;
+            }
+            else
+            {
+                led.timer_--;
+            }
+        }
+    }
+}
+
+// Blink is lit on every other beat, FastBlink for the first half of each beat
+void LooperCore::blinkToBeat(double beats)
+{
+    bool slowOn = std::fmod(beats, 2.0) < 1.0;
+    bool fastOn = std::fmod(beats, 1.0) < 0.5;
+    for (auto&& led : leds_)
+    {
+        if (led.state_ == Blink || led.state_ == FastBlink)
+        {
+            bool on = led.state_ == Blink ? slowOn : fastOn;
+            if (on && !led.on_)
+            {
+                ledOn(led.index_, LedBlinkPriority);
+            }
+            else if (!on && led.on_)
+            {
+                ledOff(led.index_, LedBlinkPriority);
+            }
+        }
+    }
+}
+
+//==============================================================================
+#if JUCE_UNIT_TESTS
+
+class LooperCoreTests : public UnitTest
+{
+public:
+    LooperCoreTests() : UnitTest("LooperCore", "loop4r") {}
+
+    struct TestOutput : public MemoryOutput
+    {
+        void bankChanged(int bank) override                         { banks_.push_back(bank); }
+        void predictionConfirmed(int loop, double) override         { confirmed_.push_back(loop); }
+
+        // the LED as it was last written, or nullptr if it wasn't
+        const LED* lastLed(int index) const
+        {
+            for (auto i = leds_.rbegin(); i != leds_.rend(); ++i)
+            {
+                if (i->led_.index_ == index)
+                {
+                    return &i->led_;
+                }
+            }
+            return nullptr;
+        }
+
+        std::vector<int> banks_;
+        std::vector<int> confirmed_;
+    };
+
+    struct Rig
+    {
+        Rig(int loops)
+        {
+            core_.setLogging(false);
+            core_.resetLoops(loops);
+            output_.clear();
+        }
+
+        void press(int pedalIdx)
+        {
+            input_.pedal(pedalIdx, true, clock_.nowMs());
+            input_.pedal(pedalIdx, false, clock_.nowMs());
+            core_.process(input_);
+        }
+
+        void tick()
+        {
+            input_.push({LooperEvent::Tick, 0, 0, clock_.nowMs()});
+            core_.process(input_);
+        }
+
+        VirtualClock clock_;
+        TestOutput output_;
+        MemoryInput input_;
+        LooperCore core_ { output_, clock_ };
+    };
+
+    void expectLed(const TestOutput& output, int index, bool on, LedStates state, const String& what)
+    {
+        const LED* led = output.lastLed(index);
+        expect(led != nullptr && led->on_ == on && led->state_ == state, what);
+    }
+
+    void runTest() override
+    {
+        beginTest("RECORD toggles Play and Rec");
+        {
+            Rig rig(4);
+            rig.press(RECORD);
+            expect(rig.core_.getMode() == Rec);
+            expectLed(rig.output_, RECORD, true, Dark, "RECORD lit in Rec");
+
+            rig.press(RECORD);
+            expect(rig.core_.getMode() == Play);
+            expectLed(rig.output_, RECORD, false, Dark, "RECORD dark in Play");
+            expect(rig.output_.commands_.empty());
+        }
+
+        beginTest("RECORD+UP/DOWN page the banks");
+        {
+            Rig rig(6);
+            expectEquals(rig.core_.bankCount(), 2);
+
+            rig.input_.pedal(RECORD, true);
+            rig.input_.pedal(UP, true);
+            rig.input_.pedal(UP, false);
+            rig.input_.pedal(UP, true);     // already on the last bank
+            rig.input_.pedal(UP, false);
+            rig.input_.pedal(RECORD, false);
+            rig.core_.process(rig.input_);
+
+            expectEquals(rig.core_.getBank(), 1);
+            expect(rig.output_.banks_ == std::vector<int> { 1 });
+            expect(rig.core_.getMode() == Play, "paging doesn't toggle the mode");
+            expect(rig.output_.commands_.empty(), "paging sends nothing to the engine");
+            expectLed(rig.output_, TRACK3, false, Dark, "no loop 7 behind the third pedal");
+
+            rig.press(TRACK2);
+            expect(rig.output_.selections_.back() == 5, "track pedals select loops in the bank");
+
+            rig.input_.pedal(RECORD, true);
+            rig.input_.pedal(DOWN, true);
+            rig.input_.pedal(DOWN, false);
+            rig.input_.pedal(RECORD, false);
+            rig.core_.process(rig.input_);
+            expectEquals(rig.core_.getBank(), 0);
+            expect(rig.output_.banks_ == std::vector<int> ({ 1, 0 }));
+        }
+
+        beginTest("Predictions are confirmed by the engine");
+        {
+            Rig rig(4);
+            rig.press(RECORD);
+            rig.output_.clear();
+
+            rig.clock_.set(100.0);
+            rig.press(TRACK1);
+            expectEquals(rig.output_.commands_.size(), (size_t) 2);
+            expect(strcmp(rig.output_.commands_[0].command_, "record") == 0);
+            expect(rig.core_.getLoops()[0].state_ == Recording);
+            expect(rig.core_.getLoops()[0].predicted_ == Recording);
+            expectLed(rig.output_, TRACK1, true, Light, "recording shows right away");
+
+            rig.clock_.advance(20.0);
+            rig.input_.loopState(0, Recording);
+            rig.core_.process(rig.input_);
+            expect(rig.output_.confirmed_ == std::vector<int> { 0 });
+            expect(rig.core_.getLoops()[0].predicted_ == Unknown);
+            expectEquals(rig.core_.getPredictions(), (int64) 1);
+            expectEquals(rig.core_.getMispredictions(), (int64) 0);
+        }
+
+        beginTest("A track pedal's release repeats its press");
+        {
+            Rig rig(4);
+            rig.input_.loopState(0, Recording);
+            rig.core_.process(rig.input_);
+            rig.press(RECORD);
+            rig.output_.clear();
+
+            rig.press(TRACK1);
+            expectEquals(rig.output_.commands_.size(), (size_t) 2);
+            expect(rig.output_.commands_[0].kind_ == CommandDown);
+            expect(rig.output_.commands_[1].kind_ == CommandUp);
+            expect(strcmp(rig.output_.commands_[0].command_, "record") == 0);
+            expect(strcmp(rig.output_.commands_[1].command_, "record") == 0, "released what was pressed");
+            expect(rig.core_.getLoops()[0].state_ != Recording, "predicted out of recording");
+        }
+
+        beginTest("Unconfirmed predictions expire");
+        {
+            Rig rig(4);
+            rig.press(RECORD);
+            rig.press(TRACK1);
+            rig.output_.clear();
+
+            rig.clock_.advance(PREDICTION_TIMEOUT);
+            rig.tick();
+            expect(rig.core_.getLoops()[0].predicted_ == Recording, "not before the timeout");
+
+            rig.clock_.advance(1.0);
+            rig.tick();
+            expect(rig.core_.getLoops()[0].predicted_ == Unknown);
+            expect(rig.core_.getLoops()[0].state_ == Off);
+            expectEquals(rig.core_.getMispredictions(), (int64) 1);
+            expectLed(rig.output_, TRACK1, false, Dark, "reverted to the engine's state");
+            expect(rig.output_.confirmed_.empty());
+        }
+
+        beginTest("Predictions wait for the loop's update interval");
+        {
+            Rig rig(8);
+            for (auto i = 0; i < 8; i++)
+            {
+                rig.input_.loopState(i, Playing);
+            }
+            rig.core_.process(rig.input_);
+            rig.core_.setUpdateInterval(0, 100.0);
+            rig.core_.setUpdateInterval(4, 1000.0);    // in the hidden bank
+            rig.core_.setRoundTrip(20.0);
+
+            rig.press(MUTE);    // mutes all of them
+            expect(rig.core_.getLoops()[4].predicted_ == Muted);
+
+            rig.clock_.advance(PREDICTION_TIMEOUT + 150.0);
+            rig.tick();
+            expect(rig.core_.getLoops()[0].predicted_ == Unknown, "the visible loop gave up");
+            expect(rig.core_.getLoops()[4].predicted_ == Muted, "the hidden loop still waits");
+
+            rig.clock_.advance(800.0);
+            rig.tick();
+            expect(rig.core_.getLoops()[4].predicted_ == Muted, "not before its interval and round trip");
+
+            rig.input_.loopState(4, Muted);
+            rig.core_.process(rig.input_);
+            expect(rig.output_.confirmed_ == std::vector<int> { 4 });
+            expect(rig.core_.getLoops()[4].state_ == Muted);
+        }
+
+        beginTest("Only frequent reports are checked for impossible changes");
+        {
+            Rig rig(2);
+            rig.core_.setUpdateInterval(0, 50.0);
+            rig.core_.setUpdateInterval(1, 1000.0);
+            rig.input_.loopState(0, Off);
+            rig.input_.loopState(1, Off);
+            rig.input_.loopState(0, Recording);
+            rig.input_.loopState(1, Playing);     // recorded between two reports
+            rig.core_.process(rig.input_);
+            expectEquals(rig.core_.getImplausibleTransitions(), (int64) 0);
+
+            rig.input_.loopState(0, Off);
+            rig.input_.loopState(0, Overdubbing);
+            rig.core_.process(rig.input_);
+            expectEquals(rig.core_.getImplausibleTransitions(), (int64) 1);
+        }
+
+        beginTest("Restoring a state checks it and writes each LED once");
+        {
+            Rig saved(6);
+            saved.input_.loopState(1, Playing);
+            saved.input_.loopState(2, Muted);
+            saved.core_.process(saved.input_);
+            saved.press(TRACK2);
+
+            LooperSnapshot state;
+            saved.core_.saveState(state);
+            state.loopStates_[4] = 99;
+
+            Rig rig(1);
+            rig.core_.restoreState(state);
+            expectEquals(rig.core_.getLoops().size(), 6);
+            expectEquals(rig.core_.getSelectedLoop(), 1);
+            expect(rig.core_.getLoops()[2].state_ == Muted);
+            expect(rig.core_.getLoops()[4].state_ == Off, "an unknown state restores as Off");
+            expectEquals(rig.output_.leds_.size(), (size_t) NUM_LEDS);
+            expectLed(rig.output_, TRACK3, saved.core_.getLeds()[TRACK3].on_, Blink, "restored as saved");
+
+            state.selectedLoop_ = 6;
+            Rig other(1);
+            other.core_.restoreState(state);
+            expectEquals(other.core_.getSelectedLoop(), -1, "a selection past the loops is dropped");
+        }
+
+        beginTest("Loop states drive the LEDs");
+        {
+            Rig rig(4);
+            rig.input_.loopState(1, Playing);
+            rig.input_.loopState(2, Muted);
+            rig.input_.loopState(3, Multiplying);
+            rig.core_.process(rig.input_);
+
+            expectLed(rig.output_, TRACK2, true, Light, "playing is lit in Play");
+            expectLed(rig.output_, TRACK3, true, Blink, "muted blinks");
+            expectLed(rig.output_, TRACK4, true, FastBlink, "multiplying blinks fast");
+            expectLed(rig.output_, MULTIPLY, true, Dark, "MULTIPLY lit while multiplying");
+
+            rig.output_.clear();
+            rig.input_.loopState(3, Playing);
+            rig.core_.process(rig.input_);
+            expectLed(rig.output_, MULTIPLY, false, Dark, "MULTIPLY dark once done");
+
+            rig.output_.clear();
+            for (auto i = 0; i <= TIMER_BLINK; i++)
+            {
+                rig.tick();
+            }
+            expectLed(rig.output_, TRACK3, false, Blink, "blink steps off");
+            expect(rig.output_.lastLed(TRACK2) == nullptr, "steady LEDs aren't rewritten");
+        }
+    }
+};
+
+static LooperCoreTests looperCoreTests;
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LoopStateMachine.h"
+#include <deque>
+#include <vector>
+
+enum LedStates
+{
+    Dark,
+    Light,
+    Blink,
+    FastBlink
+};
+
+enum LedPriority
+{
+    LedStatePriority,       // loop state changes and the selected loop display
+    LedBlinkPriority,       // blink phases
+    LedHeartbeatPriority,   // the config led heartbeat
+    NumLedPriorities
+};
+
+enum Modes
+{
+    Play = 0,
+    Rec = 20
+};
+
+static const int UP = 10;
+static const int DOWN = 11;
+static const int NUM_LEDS = 23;
+static const int BANK_SIZE = 4; // loops per bank, one per track pedal
+static const double PREDICTION_TIMEOUT = 500.0; // ms to wait for the engine to confirm a predicted state,
+                                                // on top of the loop's update interval and the OSC round trip
+static const double PLAUSIBILITY_INTERVAL = 100.0; // ms, loops reported at most this far apart can't skip a state
+
+// timers
+static const int TIMER_OFF = 0;
+static const int TIMER_FASTBLINK = 1;
+static const int TIMER_BLINK = 3;
+
+// pedals (0-3 are assigned to loops 1..4)
+static const int TRACK1 = 0;
+static const int TRACK2 = 1;
+static const int TRACK3 = 2;
+static const int TRACK4 = 3;
+static const int RECORD = 4;
+static const int MULTIPLY = 5;
+static const int REPLACE = 6;
+static const int INSERT = 7;
+static const int SUBSTITUTE = 8;
+static const int UNDO = 9;
+static const int CLEAR = UP;
+static const int MUTE = DOWN;
+static const int CONFIG = 23;
+
+struct LED {
+    int index_;
+    bool on_;
+    int timer_;
+    LedStates state_;
+
+    void clear()
+    {
+        on_ = false;
+        timer_ = TIMER_OFF;
+        state_ = Dark;
+    }
+};
+
+struct Loop {
+    int index_;
+    LoopStates state_;
+    bool empty_;
+    LedStates ledState_; // what the track led shows when the loop's bank is visible
+    double lastChange_;  // LooperClock time of the last state change
+    LoopStates confirmed_ = Unknown; // last state reported by the engine
+    LoopStates predicted_ = Unknown; // shown ahead of the engine until it reports back
+    double predictedAt_ = 0.0;
+    double pressedAt_ = 0.0;         // time of the pedal press that was predicted
+    double updateInterval_ = 0.0;    // ms between the engine's reports of the loop, 0 if not registered
+};
+
+// The core's state in a flat, fixed size form that can be copied around as is,
+// see LooperCore::saveState()
+struct LooperSnapshot
+{
+    static const int maxLoops = 128;
+
+    int32 mode_;
+    int32 selectedLoop_;
+    int32 bank_;
+    int32 loopCount_;
+    int8 loopStates_[maxLoops];
+    uint8 ledOn_[NUM_LEDS];
+    uint8 ledStates_[NUM_LEDS];
+};
+
+//==============================================================================
+// Milliseconds for the core. The app reads Time::getMillisecondCounterHiRes(),
+// tests and benchmarks step a VirtualClock instead.
+class LooperClock
+{
+public:
+    virtual ~LooperClock() {}
+    virtual double nowMs() const = 0;
+};
+
+class SystemClock : public LooperClock
+{
+public:
+    double nowMs() const override
+    {
+        return Time::getMillisecondCounterHiRes();
+    }
+};
+
+class VirtualClock : public LooperClock
+{
+public:
+    double nowMs() const override
+    {
+        return now_;
+    }
+
+    void set(double ms)
+    {
+        now_ = ms;
+    }
+
+    void advance(double ms)
+    {
+        now_ += ms;
+    }
+
+private:
+    double now_ = 0.0;
+};
+
+//==============================================================================
+// What the core wants the engine to do: a SooperLooper command sent as
+// /sl/<loop>/down, up or hit.
+enum CommandKind
+{
+    CommandDown,
+    CommandUp,
+    CommandHit
+};
+
+struct EngineCommand
+{
+    int loop_;              // a loop, -1 for all or -3 for the selected one
+    const char* command_;   // e.g. "record"
+    CommandKind kind_;
+    const char* note_;      // another .slb binding to use as a MIDI note, or nullptr
+    int noteLoop_;          // the loop of that binding
+    double pressedAt_;      // when the pedal that caused it arrived
+};
+
+// Where the core's decisions go. Called on whichever thread drives the core.
+class LooperOutput
+{
+public:
+    virtual ~LooperOutput() {}
+
+    virtual void sendCommand(const EngineCommand& command) = 0;
+    virtual void selectLoop(int loop) = 0;
+    virtual void writeLed(const LED& led, LedPriority priority) = 0;
+    virtual void showSelectedLoop(int loop) = 0;
+
+    virtual void bankChanged(int /*bank*/) {}
+    virtual void predictionConfirmed(int /*loop*/, double /*pressToStateMs*/) {}
+};
+
+//==============================================================================
+// Something that happened to the controller, in the order it happened.
+struct LooperEvent
+{
+    enum Type
+    {
+        Pedal,          // index_ is the pedal, value_ 1 for down, 0 for up
+        LoopState,      // the engine reports loop index_ in LoopStates value_
+        SelectedLoop,   // the engine selected loop value_
+        LoopCount,      // the engine has value_ loops, from scratch
+        Tick            // expire predictions and step the blink timers
+    };
+
+    Type type_;
+    int index_;
+    int value_;
+    double timeMs_;
+};
+
+class LooperInput
+{
+public:
+    virtual ~LooperInput() {}
+
+    // the next pending event, false if there is none
+    virtual bool next(LooperEvent& event) = 0;
+};
+
+//==============================================================================
+// In-memory transports, for driving the core without devices or a message loop.
+class MemoryInput : public LooperInput
+{
+public:
+    void push(const LooperEvent& event)
+    {
+        events_.push_back(event);
+    }
+
+    void pedal(int pedalIdx, bool down, double timeMs = 0.0)
+    {
+        push({LooperEvent::Pedal, pedalIdx, down ? 1 : 0, timeMs});
+    }
+
+    void loopState(int loop, LoopStates state, double timeMs = 0.0)
+    {
+        push({LooperEvent::LoopState, loop, (int) state, timeMs});
+    }
+
+    bool next(LooperEvent& event) override
+    {
+        if (events_.empty())
+        {
+            return false;
+        }
+        event = events_.front();
+        events_.pop_front();
+        return true;
+    }
+
+    size_t size() const
+    {
+        return events_.size();
+    }
+
+private:
+    std::deque<LooperEvent> events_;
+};
+
+class MemoryOutput : public LooperOutput
+{
+public:
+    struct LedWrite
+    {
+        LED led_;
+        LedPriority priority_;
+    };
+
+    void sendCommand(const EngineCommand& command) override    { commands_.push_back(command); }
+    void selectLoop(int loop) override                         { selections_.push_back(loop); }
+    void writeLed(const LED& led, LedPriority priority) override { leds_.push_back({led, priority}); }
+    void showSelectedLoop(int loop) override                   { displays_.push_back(loop); }
+
+    void clear()
+    {
+        commands_.clear();
+        selections_.clear();
+        leds_.clear();
+        displays_.clear();
+    }
+
+    std::vector<EngineCommand> commands_;
+    std::vector<int> selections_;
+    std::vector<LedWrite> leds_;
+    std::vector<int> displays_;
+};
+
+/*
+ ==============================================================================
+ The controller's logic without any I/O: pedal presses become engine
+ commands, engine states become LEDs, with the loop banks, the Play/Rec
+ mode and the predicted states in between.
+
+ Nothing here is thread safe, whoever drives the core has to serialize the
+ calls. The output is called from within them.
+ ==============================================================================
+ */
+class LooperCore
+{
+public:
+    LooperCore(LooperOutput& output, const LooperClock& clock);
+
+    // handles every event input has, returns how many there were
+    int process(LooperInput& input);
+    void handle(const LooperEvent& event);
+
+    void pedal(int pedalIdx, bool down, double pressedAt);
+    void pedalLongPress(int pedalIdx, double pressedAt);   // on top of the press, see PedalGestures
+    void pedalDoubleTap(int pedalIdx, double pressedAt);
+    void engineLoopState(int index, LoopStates state);
+    void engineSelectedLoop(int loop);
+
+    // a fresh set of loops, or more of them when the engine added some
+    void resetLoops(int count);
+    void addLoops(int count);
+
+    // how often the engine reports a loop and how long a message takes to get
+    // there and back, predictions wait that much longer to be confirmed
+    void setUpdateInterval(int loop, double ms);
+    void setRoundTrip(double ms)        { roundTripMs_ = ms; }
+    double predictionTimeout(const Loop& loop) const;
+
+    void expirePredictions();
+    void stepBlinks();                  // one step of the blink timers
+    void blinkToBeat(double beats);     // blinks in time with an external clock instead
+    void refreshLeds();                 // writes every LED as it is, e.g. to a device that just opened
+    void showBank(int bank, bool force = false);
+    void setLogging(bool log)           { log_ = log; }
+
+    // the loop states, mode, selection and LEDs, restoring also writes the LEDs
+    void saveState(LooperSnapshot& state) const;
+    void restoreState(const LooperSnapshot& state);
+
+    int bankOf(int loopIndex) const     { return loopIndex / BANK_SIZE; }
+    int bankCount() const               { return jmax(1, (loops_.size() + BANK_SIZE - 1) / BANK_SIZE); }
+    bool isLoopVisible(const Loop& loop) const { return bankOf(loop.index_) == bank_; }
+
+    const Array<Loop>& getLoops() const { return loops_; }
+    const Array<LED>& getLeds() const   { return leds_; }
+    int getSelectedLoop() const         { return selectedLoop_; }
+    int getBank() const                 { return bank_; }
+    Modes getMode() const               { return mode_; }
+    int64 getPredictions() const        { return predictions_; }
+    int64 getMispredictions() const     { return mispredictions_; }
+    int64 getImplausibleTransitions() const { return implausibleTransitions_; }
+
+private:
+    void ledOn(int pedalIdx, LedPriority priority = LedStatePriority);
+    void ledOff(int pedalIdx, LedPriority priority = LedStatePriority);
+
+    void updateLoops();
+    void updateLoopLedState(Loop& loop, LoopStates newState, bool show = true);   // show writes the LEDs
+    void showLoopLed(const Loop& loop);
+    bool handleBankPedal(int pedalIdx, bool down);
+    bool allMuted() const;
+
+    void send(int loop, const char* command, bool down, const char* note = nullptr, int noteLoop = 0);
+    void hit(int loop, const char* command);
+    void sendSelectTrack(int track);
+    void sendSelected(const char* command, LoopCommand prediction, bool down);
+    void sendClearAll(bool down);
+    void sendMuteAll();
+    void sendMuteOffAll();
+    void sendMuteSelected(bool down);
+    void sendRecordOrOverdubSelected(int pedalIdx, bool down);
+    void sendTriggerAll();
+    void sendUndoSelected(bool down);
+
+    void predictSelected(LoopCommand command);
+    void predictAll(LoopCommand command);
+    void applyPrediction(int index, LoopCommand command);
+    void reconcileLoopState(Loop& loop, LoopStates actual);
+
+    static int functionLed(LoopStates state);
+    static int ledTimer(LedStates state);
+
+    LooperOutput& output_;
+    const LooperClock& clock_;
+
+    Array<Loop> loops_;
+    Array<LED> leds_;
+    int selectedLoop_ = -1;
+    int bank_ = 0;
+    Modes mode_ = Play;
+    bool recordHeld_ = false;
+    bool bankPaged_ = false;
+    int pagingPedal_ = -1;
+    LoopCommand trackCommands_[BANK_SIZE] = { CmdRecord, CmdRecord, CmdRecord, CmdRecord }; // chosen on each track pedal's press
+    double pressedAt_ = 0.0;    // arrival of the pedal being handled
+    double roundTripMs_ = 0.0;
+    int64 predictions_ = 0;
+    int64 mispredictions_ = 0;
+    int64 implausibleTransitions_ = 0;
+    bool log_ = true;
+
+    JUCE_DECLARE_NON_COPYABLE(LooperCore)
+};
@@ -28,7 +28,27 @@
  */
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "AllocationGuard.h"
+#include "CommandQuantizer.h"
+#include "ConnectionWatchdog.h"
+#include "ControllerThread.h"
+#include "EngineSubscriptions.h"
+#include "FakeEngine.h"
+#include "JackMidiOutput.h"
+#include "LedScheduler.h"
+#include "LooperCore.h"
+#include "LoopStateMachine.h"
+#include "MetricsRegistry.h"
+#include "MidiBindings.h"
+#include "MidiClockTracker.h"
+#include "OscPacket.h"
+#include "OscSendQueue.h"
+#include "PedalGestures.h"
+#include "SessionCapture.h"
+#include "StateSnapshot.h"
+#include "Trace.h"
 #include <alsa/asoundlib.h>
+#include <limits>
 #include <sstream>
 #include <unistd.h>
 
@@ -44,69 +64,73 @@ enum CommandIndex
     CHANNEL,
     BASE_NOTE,
     OSC_IN,
-    OSC_OUT
+    OSC_OUT,
+    CAPTURE,
+    REPLAY,
+    FAKE_ENGINE,
+    WATCHDOG,
+    TRANSPORT,
+    BINDINGS,
+    JACK_OUT,
+    QUANTIZE,
+    METRICS,
+    TRACE,
+    STATE,
+    GESTURE
 };
 
-enum LoopStates
+// how loop commands reach SooperLooper
+enum Transport
 {
-    Unknown = -1,
-    Off = 0,
-    WaitStart = 1,
-    Recording = 2,
-    WaitStop = 3,
-    Playing = 4,
-    Overdubbing = 5,
-    Multiplying = 6,
-    Inserting = 7,
-    Replacing = 8,
-    Delay = 9,
-    Muted = 10,
-    Scratching = 11,
-    OneShot = 12,
-    Substitute = 13,
-    Paused = 14,
-    Last = 20
+    TransportOsc,
+    TransportMidi,     // notes on slMidiOut_, per the .slb bindings
+    TransportJack,     // the same notes on our own JACK MIDI port
+    NumTransports
 };
 
-enum LedStates
+static const char* const transportNames[NumTransports] = { "osc", "midi", "jack" };
+
+// latency samples for one transport, in ms
+struct TransportStats
 {
-    Dark,
-    Light,
-    Blink,
-    FastBlink
+    int64 count_ = 0;
+    double totalMs_ = 0.0;
+    double maxMs_ = 0.0;
+
+    void add(double ms)
+    {
+        count_++;
+        totalMs_ += ms;
+        maxMs_ = jmax(maxMs_, ms);
+    }
+
+    String toString() const
+    {
+        return String(count_) + " samples, avg " + String(count_ > 0 ? totalMs_ / count_ : 0.0, 3)
+             + " ms, max " + String(maxMs_, 3) + " ms";
+    }
 };
 
-enum Modes
+struct ScopedTransportTimer
 {
-    Play = 0,
-    Rec = 20
+    ScopedTransportTimer(TransportStats& stats) : stats_(stats), start_(Time::getMillisecondCounterHiRes()) {}
+    ~ScopedTransportTimer() { stats_.add(Time::getMillisecondCounterHiRes() - start_); }
+
+    TransportStats& stats_;
+    double start_;
 };
 
 static const String& DEFAULT_VIRTUAL_OUT_NAME = "loop4r_control_out";
 static const int DEFAULT_BASE_NOTE = 64;
-static const int UP = 10;
-static const int DOWN = 11;
-static const int NUM_LEDS = 23;
-
-// timers
-static const int TIMER_OFF = 0;
-static const int TIMER_FASTBLINK = 1;
-static const int TIMER_BLINK = 3;
-
-// pedals (0-3 are assigned to loops 1..4)
-static const int TRACK1 = 0;
-static const int TRACK2 = 1;
-static const int TRACK3 = 2;
-static const int TRACK4 = 3;
-static const int RECORD = 4;
-static const int MULTIPLY = 5;
-static const int REPLACE = 6;
-static const int INSERT = 7;
-static const int SUBSTITUTE = 8;
-static const int UNDO = 9;
-static const int CLEAR = UP;
-static const int MUTE = DOWN;
-static const int CONFIG = 23;
+
+// auto update intervals (ms), picked per loop by how active it is
+static const int AUTO_UPDATE_FAST = 50;       // selected or changing state on its own
+static const int AUTO_UPDATE_VISIBLE = 100;   // in the visible bank
+static const int AUTO_UPDATE_HIDDEN = 1000;   // in another bank
+static const int AUTO_UPDATE_IDLE = 4000;     // empty, or unchanged for LOOP_IDLE_TIME
+static const double LOOP_IDLE_TIME = 30000.0;
+static const uint32 TRANSIT_PROBE_INTERVAL = 1000; // ms between round trip probes
+static const int DEFAULT_METRICS_INTERVAL = 15;    // seconds between metrics file updates
 
 struct ApplicationCommand
 {
@@ -134,42 +158,9 @@ struct ApplicationCommand
     StringArray opts_;
 };
 
-struct LED {
-    int index_;
-    bool on_;
-    int timer_;
-    LedStates state_;
-
-    void clear()
-    {
-        on_ = false;
-        timer_ = TIMER_OFF;
-        state_ = Dark;
-    }
-};
-
-struct Loop {
-    int index_;
-    LoopStates state_;
-    bool empty_;
-    LED& led_;
-
-    void clear()
-    {
-        // we don't clear index_
-        state_ = Off;
-        empty_ = true;
-        led_.clear();
-    }
-};
-
-inline float sign(float value)
-{
-    return (float)(value > 0.) - (value < 0.);
-}
-
 class loop4r_readApplication  : public JUCEApplicationBase, public MidiInputCallback,
-public Timer, private OSCReceiver::Listener<OSCReceiver::MessageLoopCallback>
+public Timer, private OSCReceiver::Listener<OSCReceiver::RealtimeCallback>,
+private LooperOutput, private ControllerThread::Client, private PedalGestures::Listener
 {
 public:
     //==============================================================================
@@ -184,11 +175,18 @@ public:
         commands_.add({"base",  "base note",        BASE_NOTE,          1, "number",         "Starting note"});
         commands_.add({"oin",   "osc in",           OSC_IN,             1, "number",         "OSC receive port"});
         commands_.add({"oout",  "osc out",          OSC_OUT,            1, "number",         "OSC send port"});
-
-        for (auto i=0; i<NUM_LEDS; i++)
-        {
-            leds_.add({i, false, TIMER_OFF, Dark});
-        }
+        commands_.add({"cap",   "capture",          CAPTURE,            1, "file",           "Capture pedal MIDI, OSC and LED traffic to a file"});
+        commands_.add({"replay", "",                REPLAY,            -1, "file (speed)",   "Replay a capture through the controller, speed 0 runs as fast as possible"});
+        commands_.add({"fake",  "fake engine",      FAKE_ENGINE,       -1, "(loops) (rate)", "Run a stand-in SooperLooper on the OSC send port, optionally flooding rate updates/s"});
+        commands_.add({"transport", "",             TRANSPORT,          1, "osc|midi|jack",  "Send loop commands over OSC, or as MIDI notes on the SooperLooper MIDI out or JACK port"});
+        commands_.add({"jack",  "jack out",         JACK_OUT,          -1, "(port)",         "Register a JACK MIDI output, optionally connected to port, e.g. sooperlooper:midi_in"});
+        commands_.add({"slb",   "bindings",         BINDINGS,           1, "file",           "Load the MIDI note bindings from a SooperLooper .slb file"});
+        commands_.add({"wd",    "watchdog",         WATCHDOG,           1, "ms",             "Declare the engine lost after this much silence, defaults to 300 ms"});
+        commands_.add({"quant", "quantize",         QUANTIZE,           1, "off|cycle|beat", "Hold pedal commands until just before the next loop cycle or MIDI clock beat"});
+        commands_.add({"metrics", "",               METRICS,           -1, "file (seconds)", "Write Prometheus metrics to file every 15 or the given seconds, e.g. for node_exporter"});
+        commands_.add({"trace", "",                 TRACE,              1, "file",           "Write trace spans to file on exit or /loop4r/trace, needs a LOOP4R_TRACE=1 build"});
+        commands_.add({"state", "",                 STATE,              1, "file",           "Keep the loops and LEDs in file as they change and show them again at startup"});
+        commands_.add({"gesture", "",               GESTURE,            4, "pedal debounce hold tap", "Per pedal (1-10, up, down, tracks or all): ms of switch chatter to ignore, to hold a track pedal to clear its loop and between two UNDO taps to undo all, 0 turns one off"});
 
         channel_ = 1;
         baseNote_ = DEFAULT_BASE_NOTE;
@@ -200,12 +198,50 @@ public:
         loopCount_ = 0;
         hostUrl_ = "";
         version_ = "";
-        selectedLoop_ = -1;
         pinged_ = false;
-        mode_ = Play;
-        heartbeat_ = 5;
         engineId_ = 0;
         currentCommand_ = ApplicationCommand::Dummy();
+        hitNotes_.ensureSize(32);
+
+        oscSender.registerPacketHandler([this] (const char* data, int size)
+        {
+            oscDatagramsOut_.fetch_add(1, std::memory_order_relaxed);
+            capture_.record(CaptureOscOut, data, size);
+        });
+        oscLedSender.registerPacketHandler([this] (const char* data, int size)
+        {
+            oscDatagramsOut_.fetch_add(1, std::memory_order_relaxed);
+            capture_.record(CaptureOscOut, data, size);
+        });
+        watchdog_.onStateChange = [this] (ConnectionWatchdog::State state) { handleConnectionState(state); };
+        controller_.addInput(midiEvents_);
+        controller_.addInput(replayEvents_);
+        controller_.addInput(timerEvents_);
+        registerMetrics();
+    }
+
+    void registerMetrics()
+    {
+        metrics_.addCounter("loop4r_midi_events_in_total", "MIDI events received from the pedals", [this] { return (double) midiEventsIn_; });
+        metrics_.addCounter("loop4r_osc_datagrams_in_total", "OSC datagrams received", [this] { return (double) oscDatagramsIn_; });
+        metrics_.addCounter("loop4r_osc_datagrams_out_total", "OSC datagrams sent to the engine and the LED mirror", [this] { return (double) oscDatagramsOut_; });
+        metrics_.addCounter("loop4r_rawmidi_bytes_written_total", "Bytes written to the FCB1010 rawmidi port", [this] { return (double) ledOutput_.getBytesWritten(); });
+        metrics_.addCounter("loop4r_led_writes_total", "LED and display messages queued for the FCB1010", [this] { return (double) ledWrites_; });
+        metrics_.addCounter("loop4r_led_collapsed_total", "LED messages replaced before they were sent", [this] { return (double) ledScheduler_.getCollapsedCount(); });
+        metrics_.addCounter("loop4r_led_drops_total", "LED messages dropped on a full rawmidi queue", [this] { return (double) ledOutput_.getDropCount(); });
+        metrics_.addCounter("loop4r_engine_reconnects_total", "Times the engine came back after being lost", [this] { return (double) engineReconnects_; });
+        metrics_.addCounter("loop4r_engine_lost_total", "Times the engine was declared lost", [this] { return (double) engineLosses_; });
+        metrics_.addCounter("loop4r_heartbeat_misses_total", "Times the engine went quiet and had to be probed", [this] { return (double) watchdog_.getProbeCount(); });
+        metrics_.addCounter("loop4r_mispredictions_total", "Predicted loop states the engine didn't confirm", [this] { return (double) mispredictions_; });
+        metrics_.addCounter("loop4r_jack_drops_total", "Commands dropped on a full JACK queue", [this] { return (double) jackOut_.getDropCount(); });
+        metrics_.addCounter("loop4r_pedal_chatter_total", "Pedal edges ignored as switch chatter", [this] { return (double) pedalChatter_; });
+        metrics_.addCounter("loop4r_capture_drops_total", "Capture records dropped on a full queue", [this] { return (double) capture_.getDropCount(); });
+        metrics_.addCounter("loop4r_osc_mirror_drops_total", "LED mirror packets dropped on a full send queue", [this] { return (double) sendQueue_.getDropCount(); });
+        metrics_.addGauge("loop4r_engine_up", "1 while the engine answers", [this] { return engineAlive_ ? 1.0 : 0.0; });
+        metrics_.addGauge("loop4r_loops", "Loops reported by the engine", [this] { return (double) loopsShown_; });
+        metrics_.addGauge("loop4r_rawmidi_queue_bytes", "Bytes waiting in the rawmidi queue", [this] { return (double) ledOutput_.getFillLevel(); });
+        metrics_.addGauge("loop4r_osc_transit_ms", "Estimated one way OSC transit time", [this] { return quantizer_.getTransitMs(); });
+        metrics_.addGauge("loop4r_midi_clock_bpm", "Tempo of the external MIDI clock, 0 without one", [this] { return midiClock_.getTempo(Time::getMillisecondCounterHiRes()); });
     }
 
     const String getApplicationName() override       { return ProjectInfo::projectName; }
@@ -228,6 +264,12 @@ public:
             systemRequestedQuit();
             return;
         }
+        else if (cmdLineParams.contains("--test"))
+        {
+            runUnitTests();
+            systemRequestedQuit();
+            return;
+        }
 
         parseParameters(cmdLineParams);
 
@@ -249,6 +291,10 @@ public:
         }
         else
         {
+            // connect now rather than on the first tick
+            sendQueue_.start();
+            controller_.start();
+            timerCallback();
             startTimer(200);
         }
     }
@@ -270,28 +316,25 @@ public:
             }
         }
 
-        int err;
-        if (midiOutName_.isNotEmpty() && midiOut_ == nullptr)
+        if (midiOutName_.isNotEmpty() && !ledOutput_.isOpen())
         {
-            err = snd_rawmidi_open(NULL,&midiOut_, midiOutName_.toRawUTF8(), 0);
-            if (err)
+            if (ledOutput_.open(midiOutName_) < 0)
             {
                 std::cerr << "Couldn't open MIDI output port \"" << midiOutName_ << "\"" << std::endl;
             }
             else
             {
-                // initialize the leds to off
-                for (auto i=0; i<NUM_LEDS; i++)
-                    ledOff(i);
+                // show the leds as the core has them, all off unless a state was restored
+                controller_.call([this] { core_.refreshLeds(); });
             }
         }
 
 #if (JUCE_LINUX || JUCE_MAC)
-        if (virtMidiOutName_.isNotEmpty() && slMidiOutName_.isEmpty() && slMidiOut_ == nullptr)
+        if (virtMidiOutName_.isNotEmpty() && slMidiOutName_.isEmpty() && !slMidiOutOpen_)
         {
 
-            slMidiOut_ = MidiOutput::createNewDevice(virtMidiOutName_);
-            if (slMidiOut_ == nullptr)
+            setSooperLooperMidiOut(MidiOutput::createNewDevice(virtMidiOutName_));
+            if (!slMidiOutOpen_)
             {
                 std::cerr << "Couldn't create virtual MIDI output port \"" << virtMidiOutName_ << "\"" << std::endl;
             }
@@ -301,27 +344,10 @@ public:
 #endif
         }
 
-        if (slMidiOutName_.isNotEmpty() && virtMidiOutName_.isEmpty() && slMidiOut_ == nullptr)
+        if (slMidiOutName_.isNotEmpty() && virtMidiOutName_.isEmpty() && !slMidiOutOpen_)
         {
-            int index = MidiOutput::getDevices().indexOf(slMidiOutName_);
-            if (index >= 0)
-            {
-                slMidiOut_ = MidiOutput::openDevice(index);
-            }
-            else
-            {
-                StringArray devices = MidiOutput::getDevices();
-                for (int i = 0; i < devices.size(); ++i)
-                {
-                    if (devices[i].containsIgnoreCase(slMidiOutName_))
-                    {
-                        slMidiOut_ = MidiOutput::openDevice(i);
-                        slMidiOutName_ = devices[i];
-                        break;
-                    }
-                }
-            }
-            if (slMidiOut_ == nullptr)
+            setSooperLooperMidiOut(openSooperLooperMidiOut());
+            if (!slMidiOutOpen_)
             {
                 std::cerr << "Couldn't find MIDI output port \"" << slMidiOutName_ << "\"" << std::endl;
             }
@@ -331,215 +357,254 @@ public:
             if (tryToConnectOsc())
             {
                 std::cerr << "Connected to OSC ports " << (int)currentReceivePort_ << " (in), " << (int) currentSendPort_ << " (out)" << std::endl;
-                heartbeat_ = 5;
             }
         }
         else
         {
-            // heartbeat
-            if (heartbeat_ == 0)
-            {
-                unsigned char ch[]={MIDI_CMD_CONTROL, (unsigned char)(heartbeatOn_ ? 107 : 106), (unsigned char)CONFIG};
-                ssize_t wrote = snd_rawmidi_write(midiOut_, &ch, sizeof(ch));
-                if (wrote != sizeof(ch))
-                {
-                    std::cerr << "Could not write CC " << (int)(heartbeatOn_ ? 107 :106) << " " << (int)CONFIG << std::endl;
-                }
-                heartbeatOn_ = !heartbeatOn_;
-            }
-            else if (heartbeat_ < -5) // give a second before we try reconnecting
+            followClock();
+            controller_.post(timerEvents_, {LooperEvent::Tick, 0, 0, Time::getMillisecondCounterHiRes()});
+        }
+
+        if (ledOutput_.getDropCount() != reportedLedDrops_)
+        {
+            reportedLedDrops_ = ledOutput_.getDropCount();
+            std::cerr << "FCB1010 output queue full (" << ledOutput_.getFillLevel() << "/" << ledOutput_.getCapacity()
+                      << " bytes), " << reportedLedDrops_ << " LED messages dropped so far" << std::endl;
+        }
+
+        capture_.flush();
+        writeMetricsFile();
+
+        if (replayFile_ != File() && isConnected())
+        {
+            startReplay();
+        }
+    }
+
+    // opens the port named slMidiOutName_, or the first one containing it
+    MidiOutput* openSooperLooperMidiOut()
+    {
+        int index = MidiOutput::getDevices().indexOf(slMidiOutName_);
+        if (index >= 0)
+        {
+            return MidiOutput::openDevice(index);
+        }
+
+        StringArray devices = MidiOutput::getDevices();
+        for (int i = 0; i < devices.size(); ++i)
+        {
+            if (devices[i].containsIgnoreCase(slMidiOutName_))
             {
-                // we've lost heartbeat, try reconnecting
-                currentReceivePort_ = -1;
-                currentSendPort_ = -1;
-                if (tryToConnectOsc())
-                {
-                    std::cerr << "Reconnected to OSC ports " << (int)currentReceivePort_ << " (in) and " << (int) currentSendPort_ << " (out)" << std::endl;
-                    heartbeat_ = 5;
-                }
+                slMidiOutName_ = devices[i];
+                return MidiOutput::openDevice(i);
             }
-            else
+        }
+        return nullptr;
+    }
+
+    // The commands are sent on the controller thread, so the port is swapped
+    // there too. out may be nullptr to close it.
+    void setSooperLooperMidiOut(MidiOutput* out)
+    {
+        slMidiOutOpen_ = out != nullptr;
+        controller_.call([this, out] { slMidiOut_ = out; });
+    }
+
+    // Blinking follows an external MIDI clock while it is locked and running,
+    // otherwise the timer counts above
+    void followClock()
+    {
+        double now = Time::getMillisecondCounterHiRes();
+        bool locked = midiClock_.isLocked(now) && midiClock_.isRunning();
+        if (locked == clockLocked_)
+        {
+            return;
+        }
+
+        clockLocked_ = locked;
+        if (locked)
+        {
+            std::cerr << "Following MIDI clock at " << String(midiClock_.getTempo(now), 1) << " bpm" << std::endl;
+            controller_.setWakeInterval(10);
+        }
+        else
+        {
+            std::cerr << "MIDI clock stopped" << std::endl;
+            controller_.setWakeInterval(0);
+        }
+    }
+
+    void blinkToClock()
+    {
+        double beats = midiClock_.getBeatPosition(Time::getMillisecondCounterHiRes());
+        if (beats < 0.0)
+        {
+            return; // followClock() falls back to the timer
+        }
+
+        core_.blinkToBeat(beats);
+    }
+
+    void toggleHeartbeatLed()
+    {
+        unsigned char ch[]={MIDI_CMD_CONTROL, (unsigned char)(heartbeatOn_ ? 107 : 106), (unsigned char)CONFIG};
+        writeRawMidi(LedHeartbeatPriority, ch, sizeof(ch));
+        heartbeatOn_ = !heartbeatOn_;
+    }
+
+    // Connection events from the watchdog, on the message thread. Resyncing
+    // is left to the /pingack the watchdog asked for.
+    void handleConnectionState(ConnectionWatchdog::State state)
+    {
+        bool wasLost = engineLosses_ > engineReconnects_;
+        engineAlive_ = state == ConnectionWatchdog::Connected;
+        if (engineAlive_)
+        {
+            if (wasLost)
             {
-                --heartbeat_;
+                engineReconnects_++;
             }
-
-            // handle pedal led state for blinking pedals
-            for (auto&& led : leds_)
+            std::cerr << "SooperLooper is reachable" << std::endl;
+            controller_.call([this]
             {
-                if (led.state_ == Blink || led.state_ == FastBlink)
+                if (heartbeatOn_)
                 {
-                    if (led.timer_ <= 0)
-                    {
-                        if (led.on_) {
-                            ledOff(led.index_);
-                        }
-                        else
-                        {
-                            ledOn(led.index_);
-                        }
-                        led.timer_ = led.state_ == Blink ? TIMER_BLINK : TIMER_FASTBLINK;
-                    }
-                    else
-                    {
-                        led.timer_--;
-                    }
+                    toggleHeartbeatLed();
                 }
-            }
+            });
         }
+        else if (state == ConnectionWatchdog::Lost)
+        {
+            engineLosses_++;
+            std::cerr << "SooperLooper is not responding, reconnecting" << std::endl;
+        }
+    }
+
+    void startWatchdog()
+    {
+        watchdog_.start("127.0.0.1", currentSendPort_, "osc.udp://localhost:" + String(currentReceivePort_) + "/", watchdogWindow_);
     }
 
-    void updateLoops()
+    // Feeds a capture back in: pedal events go straight to the MIDI handler,
+    // OSC datagrams are sent to our own receive port.
+    void startReplay()
     {
-        for (auto&& loop : loops_)
+        replay_.reset(new SessionReplay());
+        replay_->onMidiIn = [this] (const MidiMessage& msg)
         {
-            updateLoopLedState(loop, loop.state_);
+            handleIncomingMidiMessage(nullptr, msg);
+        };
+        replay_->onOscIn = [this] (const void* data, int size)
+        {
+            replaySocket_.write("127.0.0.1", currentReceivePort_, data, size);
+        };
+       #if LOOP4R_ALLOC_GUARD
+        // the replay is the allocation test: exits 1 if a steady state event allocated
+        loop4rAlloc::arm(true);
+        replay_->onFinished = []
+        {
+            MessageManager::callAsync([]
+            {
+                loop4rAlloc::arm(false);
+                bool clean = loop4rAlloc::report();
+                std::cerr << (clean ? "No steady state allocations" : "Error: steady state events allocated") << std::endl;
+                JUCEApplicationBase::getInstance()->setApplicationReturnValue(clean ? 0 : 1);
+                JUCEApplicationBase::quit();
+            });
+        };
+       #endif
+
+        if (replay_->start(replayFile_, replaySpeed_))
+        {
+            std::cerr << "Replaying " << replayFile_.getFullPathName() << std::endl;
         }
+        replayFile_ = File();
     }
 
-    void updateLoopLedState(Loop& loop, LoopStates newState)
+    //==============================================================================
+    // How often the engine should report a loop: fast while something is about
+    // to happen on it, slow once it's out of sight or hasn't changed in a while.
+    int autoUpdateInterval(const Loop& loop) const
     {
-        std::cerr << "updating " << loop.index_ << " state: ";
-        switch (newState)
+        switch (loop.state_)
         {
-            case Unknown:
-            case Off:
-                std::cerr << "Off" << std::endl;
-                loop.led_.state_ = Dark;
-                loop.led_.timer_ = TIMER_OFF;
-                ledOff(loop.index_);
-                break;
             case WaitStart:
             case WaitStop:
-                std::cerr << "Wait Start/Stop" << std::endl;
-                loop.led_.state_ = FastBlink;
-                loop.led_.timer_ = TIMER_FASTBLINK;
-                ledOn(loop.index_);
-                break;
             case Recording:
-                std::cerr << "Recording" << std::endl;
-                loop.led_.state_ = Light;
-                loop.led_.timer_ = TIMER_OFF;
-                ledOn(loop.index_);
-                break;
-            case Overdubbing:
-                std::cerr << "Overdubbing" << std::endl;
-                loop.led_.state_ = Light;
-                loop.led_.timer_ = TIMER_OFF;
-                ledOn(loop.index_);
-                break;
-            case Inserting:
-                std::cerr << "Inserting" << std::endl;
-                loop.led_.state_ = FastBlink;
-                loop.led_.timer_ = TIMER_FASTBLINK;
-                ledOn(loop.index_);
-                ledOn(INSERT);
-                break;
-            case Replacing:
-                std::cerr << "Replacing" << std::endl;
-                loop.led_.state_ = FastBlink;
-                loop.led_.timer_ = TIMER_FASTBLINK;
-                ledOn(loop.index_);
-                ledOn(REPLACE);
-                break;
-            case Substitute:
-                std::cerr << "Substituting" << std::endl;
-                loop.led_.state_ = FastBlink;
-                loop.led_.timer_ = TIMER_FASTBLINK;
-                ledOn(loop.index_);
-                ledOn(SUBSTITUTE);
-                break;
             case Multiplying:
-                std::cerr << "Multiplying" << std::endl;
-                loop.led_.state_ = FastBlink;
-                loop.led_.timer_ = TIMER_FASTBLINK;
-                ledOn(loop.index_);
-                ledOn(MULTIPLY);
-                break;
-            case Delay:
-                std::cerr << "Delay" << std::endl;
-                loop.led_.state_ = Light;
-                loop.led_.timer_ = TIMER_OFF;
-                ledOn(loop.index_);
-                break;
-            case Scratching:
-                std::cerr << "Scratching" << std::endl;
-                loop.led_.state_ = Light;
-                loop.led_.timer_ = TIMER_OFF;
-                ledOn(loop.index_);
-                break;
-            case OneShot:
-                std::cerr << "Oneshot" << std::endl;
-                loop.led_.state_ = Light;
-                loop.led_.timer_ = TIMER_OFF;
-                ledOn(loop.index_);
-                break;
-            case Playing:
-                std::cerr << "Playing" << std::endl;
-                if (mode_ == Play)
-                {
-                    loop.led_.state_ = Light;
-                    loop.led_.timer_ = TIMER_OFF;
-                    ledOn(loop.index_);
-                }
-                else
-                {
-                    loop.led_.state_ = Blink;
-                    loop.led_.timer_ = TIMER_BLINK;
-                    ledOn(loop.index_);
-                }
-                break;
-            case Muted:
-            case Paused:
-                std::cerr << "Muted/Paused" << std::endl;
-                loop.led_.state_ = Blink;
-                loop.led_.timer_ = TIMER_BLINK;
-                ledOn(loop.index_);
-                break;
-            case Last:
-                std::cerr << "Last" << std::endl;
-                loop.led_.state_ = Dark;
-                loop.led_.timer_ = TIMER_OFF;
-                ledOff(loop.index_);
-                break;
+            case Inserting:
+                return AUTO_UPDATE_FAST;
             default:
-                std::cerr << "default" << std::endl;
-                loop.led_.state_ = Dark;
-                loop.led_.timer_ = TIMER_OFF;
-                ledOff(loop.index_);
                 break;
         }
 
-        if (newState != loop.state_)
+        if (loop.index_ == core_.getSelectedLoop())
         {
-            // turn off any leds that are no longer active
-            switch(loop.state_)
-            {
-                case Multiplying:
-                    ledOff(MULTIPLY);
-                    break;
-                case Replacing:
-                    ledOff(REPLACE);
-                    break;
-                case Inserting:
-                    ledOff(INSERT);
-                    break;
-                case Substitute:
-                    ledOff(SUBSTITUTE);
-                    break;
-                default:
-                    break;
-            }
+            return AUTO_UPDATE_FAST;
+        }
+
+        if (loop.empty_ || clock_.nowMs() - loop.lastChange_ > LOOP_IDLE_TIME)
+        {
+            return AUTO_UPDATE_IDLE;
+        }
+
+        return core_.isLoopVisible(loop) ? AUTO_UPDATE_VISIBLE : AUTO_UPDATE_HIDDEN;
+    }
+
+    // re-registers the loops whose interval changed, a no-op for all others
+    void adaptAutoUpdates()
+    {
+        if (!isConnected())
+        {
+            return;
+        }
+
+        for (auto i = 0; i < core_.getLoops().size(); i++)
+        {
+            registerAutoUpdates(i, false);
+        }
+    }
+
+    void resetLoops(int count)
+    {
+        subscriptions_.reset();
+        if (restored_ && count == core_.getLoops().size())
+        {
+            // keep showing the restored states, the queries below reconcile them
+            core_.showBank(core_.getBank(), true);
+        }
+        else
+        {
+            core_.resetLoops(count);
+        }
+        restored_ = false;
+        for (auto i = 0; i < count; i++)
+        {
+            registerAutoUpdates(i, false);
+            getCurrentState(i);
         }
-        loop.state_ = newState;
-        loop.empty_ = loop.state_ == Off;
     }
 
     void shutdown() override
     {
         // Add your application's shutdown code here..
-        if (midiOut_) {
-            snd_rawmidi_close(midiOut_);
+        replay_ = nullptr;
+        controller_.stop();
+        for (auto t = 0; t < NumTransports; t++)
+        {
+            if (dispatchStats_[t].count_ > 0)
+            {
+                std::cerr << transportNames[t] << " send: " << dispatchStats_[t].toString() << std::endl
+                          << transportNames[t] << " pedal to engine state: " << confirmStats_[t].toString() << std::endl;
+            }
         }
+        sendQueue_.stop();
+        watchdog_.stop();
+        fakeEngine_ = nullptr;
+        capture_.stop();
+        jackOut_.close();
+        ledOutput_.close();
+        writeTrace();
     }
 
     //==============================================================================
@@ -670,356 +735,278 @@ private:
         return channel == 0 || msg.getChannel() == channel;
     }
 
-    void sendClearAll(bool down)
-    {
-        String buf = "/sl/-1/";
-        buf = buf + (down ? "down" : "up");
-
-        oscSender.send(buf, (String) "undo_all");
-        std::cerr << "clear all" << std::endl;
-    }
-
-    void sendClearSelected(bool down)
-    {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        oscSender.send(buf, (String) "undo_all");
-        std::cerr << "clear selected" << std::endl;
-    }
-
-    void sendInsert(int loop, bool down)
+    // Sends a SooperLooper command as its bound MIDI note when the MIDI
+    // transport is selected, returns false if it has to go over OSC instead.
+    // at is when the command was due, for placing it within a JACK period.
+    bool sendCommandNote(const char* command, int loop, bool down, double at)
     {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        oscSender.send(buf, (String) "insert");
-        std::cerr << "insert " << loop << std::endl;
-    }
+        const MidiBindings::Binding* binding = findCommandNote(command, loop);
+        if (binding == nullptr)
+        {
+            return false;
+        }
 
-    void sendMultiply(int loop, bool down)
-    {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        oscSender.send(buf, (String) "multiply");
-        std::cerr << "multiply " << loop << std::endl;
+        ScopedTransportTimer timer(dispatchStats_[transport_]);
+        MidiMessage message = down ? MidiMessage::noteOn(binding->channel_, binding->note_, (uint8) 127)
+                                   : MidiMessage::noteOff(binding->channel_, binding->note_, (uint8) 0);
+        if (transport_ == TransportJack)
+        {
+            jackOut_.send(message, at);
+        }
+        else
+        {
+            slMidiOut_->sendMessageNow(message);
+        }
+        return true;
     }
 
-    void sendMute(int loop, bool down)
+    // press and release back to back, the MIDI version of /hit
+    bool hitCommandNote(const char* command, int loop, double at)
     {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        oscSender.send(buf, (String) "mute");
-        std::cerr << "mute " << loop << std::endl;
-    }
+        const MidiBindings::Binding* binding = findCommandNote(command, loop);
+        if (binding == nullptr)
+        {
+            return false;
+        }
 
-    void sendMuteAll()
-    {
-        String buf = "/sl/-1/hit";
-        oscSender.send(buf, (String) "mute_on");
-        std::cerr << "mute all" << std::endl;
+        ScopedTransportTimer timer(dispatchStats_[transport_]);
+        MidiMessage on = MidiMessage::noteOn(binding->channel_, binding->note_, (uint8) 127);
+        MidiMessage off = MidiMessage::noteOff(binding->channel_, binding->note_, (uint8) 0);
+        if (transport_ == TransportJack)
+        {
+            // the release goes out a frame after the press
+            jackOut_.send(on, at);
+            jackOut_.send(off, at, 1);
+        }
+        else
+        {
+            hitNotes_.clear();
+            hitNotes_.addEvent(on, 0);
+            hitNotes_.addEvent(off, 0);
+            slMidiOut_->sendBlockOfMessagesNow(hitNotes_);
+        }
+        return true;
     }
 
-    void sendMuteOffAll()
+    const MidiBindings::Binding* findCommandNote(const char* command, int loop) const
     {
-        String buf = "/sl/-1/hit";
-        oscSender.send(buf, (String) "mute_off");
-        std::cerr << "mute off all" << std::endl;
+        bool ready = transport_ == TransportMidi ? slMidiOut_ != nullptr
+                   : transport_ == TransportJack ? jackOut_.isOpen()
+                   : false;
+        if (!ready)
+        {
+            return nullptr;
+        }
+        return midiBindings_.find(command, loop);
     }
 
-    void sendMuteSelected(bool down)
-    {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        oscSender.send(buf, (String) "mute");
-        std::cerr << "mute " << selectedLoop_ << std::endl;
-    }
+    //==============================================================================
+    // LooperOutput: where the core's decisions leave the controller
 
-    void sendRecordOrOverdubSelected(bool down)
+    // Sends right away, or holds the command until just before the next
+    // boundary when quantizing. A release waits for the presses still pending.
+    void sendCommand(const EngineCommand& command) override
     {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        auto loop = loops_.getReference(selectedLoop_);
-        if (loop.state_ == Recording)
+        double now = Time::getMillisecondCounterHiRes();
+        double at = 0.0;
+        if (quantizer_.getMode() != QuantizeOff && isQuantized(command.command_))
         {
-            oscSender.send(buf, (String) "record");
+            at = command.kind_ == CommandUp ? schedule_.getLatestPending()
+               : quantizer_.getSendTime(command.loop_ < 0 ? core_.getSelectedLoop() : command.loop_, now);
         }
-        else if (loop.state_ == Overdubbing)
+
+        if (at > now || (command.kind_ == CommandUp && at > 0.0))
         {
-            oscSender.send(buf, (String) "overdub");
+            if (schedule_.add(at, command))
+            {
+                return;
+            }
+            // no room to hold it, send it late rather than out of order
+            sendQuantized(std::numeric_limits<double>::max());
         }
-        else if (loop.empty_)
+        dispatchCommand(command, command.pressedAt_);
+    }
+
+    // at is when the command was due, for placing it within a JACK period
+    void dispatchCommand(const EngineCommand& command, double at)
+    {
+        if (command.kind_ == CommandHit)
         {
-            oscSender.send(buf, (String) "record");
+            hitLoopCommand(command.loop_, command.command_, at);
         }
         else
         {
-            oscSender.send(buf, (String) "overdub");
+            sendLoopCommand(command.loop_, command.command_, command.kind_ == CommandDown,
+                            command.note_, command.noteLoop_, at);
         }
-        std::cerr << "record selected" << std::endl;
     }
 
-    void sendReplace(int loop, bool down)
+    // sends the held commands that are due by nowMs
+    void sendQuantized(double nowMs)
     {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        oscSender.send(buf, (String) "replace");
-        std::cerr << "replace " << loop << std::endl;
+        schedule_.sendDue(nowMs, [this] (const EngineCommand& command)
+        {
+            dispatchCommand(command, Time::getMillisecondCounterHiRes());
+        });
     }
 
-    void sendSelectTrack(int track)
+    void selectLoop(int loop) override
     {
-        selectedLoop_ = track;
-        String buf = "/set";
-        oscSender.send(buf, (String) "selected_loop_num", (int) track);
-        std::cerr << "select track" << track << std::endl;
+        OscPacket packet("/set", "si");
+        packet.addString("selected_loop_num");
+        packet.addInt32(loop);
+        sendQueue_.post(oscSender, packet, OscSendQueue::EngineLane);
     }
 
-    void sendSubstitute(int loop, bool down)
+    void writeLed(const LED& led, LedPriority priority) override
     {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        oscSender.send(buf, (String) "substitute");
-        std::cerr << "substitute " << loop << std::endl;
+        LOOP4R_TRACE_SCOPE("writeLed");
+        int cc = led.on_ ? 106 : 107;
+        unsigned char ch[]={MIDI_CMD_CONTROL, (unsigned char) cc, ledNumber(led.index_)};
+        writeRawMidi(priority, ch, sizeof(ch));
+
+        if (oscLedSenderInitialized_)
+        {
+            OscPacket packet("/led", "iiii");
+            packet.addInt32(led.index_);
+            packet.addInt32(led.on_ ? 1 : 0);
+            packet.addInt32(led.timer_);
+            packet.addInt32(led.state_);
+            sendQueue_.post(oscLedSender, packet, OscSendQueue::MirrorLane);
+        }
     }
 
-    void sendUndoSelected(bool down)
+    void showSelectedLoop(int loop) override
     {
-        String buf = "/sl/-3/";
-        buf = buf + (down ? "down" : "up");
-        oscSender.send(buf, (String) "undo");
-        std::cerr << "undo selected" << std::endl;
+        unsigned char ch[]={MIDI_CMD_CONTROL, 108, (unsigned char)(loop + 1)};
+        writeRawMidi(LedStatePriority, ch, sizeof(ch));
+
+        if (oscLedSenderInitialized_)
+        {
+            OscPacket packet("/display", "i");
+            packet.addInt32(loop);
+            sendQueue_.post(oscLedSender, packet, OscSendQueue::MirrorLane);
+        }
     }
 
-    void sendTriggerAll()
+    void bankChanged(int) override
     {
-        String buf = "/sl/-1/hit";
-        oscSender.send(buf, (String) "trigger");
-        std::cerr << "trigger all" << std::endl;
+        adaptAutoUpdates();
     }
 
-    void sendUnmuteAll(bool down)
+    void predictionConfirmed(int, double pressToStateMs) override
     {
-        String buf = "/sl/-1/";
-        buf = buf + (down ? "down" : "up");
-        bool allMute = true;
-        for (auto&& loop : loops_)
-        {
-            if (loop.state_ != Unknown && loop.state_ != Off &&
-                loop.state_ != Muted && loop.state_ != Paused)
-            {
-                allMute = false;
-                break;
-            }
-        }
+        confirmStats_[transport_].add(pressToStateMs);
+    }
 
-        if (allMute) {
-            oscSender.send(buf, (String) "trigger");
-            std::cerr << "trigger all" << std::endl;
-        }
-        else
+    // note and noteLoop pick another .slb binding than the command's own
+    void sendLoopCommand(int loop, const char* command, bool down,
+                         const char* note, int noteLoop, double at)
+    {
+        if (!sendCommandNote(note != nullptr ? note : command, note != nullptr ? noteLoop : loop, down, at))
         {
-            oscSender.send(buf, (String) "mute_off");
-            std::cerr << "mute_off all" << std::endl;
+            ScopedTransportTimer timer(dispatchStats_[TransportOsc]);
+            sendOscCommand(loop, down ? "down" : "up", command);
         }
     }
 
-    void handleIncomingMidiMessage(MidiInput*, const MidiMessage& msg) override
+    void hitLoopCommand(int loop, const char* command, double at)
     {
-        if (!filterCommands_.isEmpty())
+        if (!hitCommandNote(command, loop, at))
         {
-            bool filtered = false;
-            for (ApplicationCommand& cmd : filterCommands_)
-            {
-                switch (cmd.command_)
-                {
-                    case CHANNEL:
-                        channel_ = asDecOrHex7BitValue(cmd.opts_[0]);
-                        break;
-                    default:
-                        // no-op
-                        break;
-                }
-            }
-
-            if (!filtered)
-            {
-                return;
-            }
+            ScopedTransportTimer timer(dispatchStats_[TransportOsc]);
+            sendOscCommand(loop, "hit", command);
         }
+    }
 
-        if (msg.isController()) {
-            int pedalIdx = pedalIndex(msg.getControllerValue());
-            bool down = msg.getControllerNumber() == 104 ? true : false;
-
-            switch (pedalIdx)
-            {
-                case TRACK1:
-                case TRACK2:
-                case TRACK3:
-                case TRACK4:
-                    sendSelectTrack(pedalIdx);
-                    if (mode_ == Rec)
-                    {
-                        sendRecordOrOverdubSelected(down);
-                    }
-                    else
-                    {
-                        sendMuteSelected(down);
-                    }
-                    break;
-
-                case MULTIPLY:
-                    if (mode_ == Rec)
-                    {
-                        sendMultiply(selectedLoop_, down);
-                    }
-                    break;
-
-                case CLEAR:
-                    if (mode_ == Rec)
-                    {
-                        sendClearSelected(down);
-                    }
-                    else
-                    {
-                        sendClearAll(down);
-                    }
-                    break;
-
-                case REPLACE:
-                    if (mode_ == Rec)
-                    {
-                        sendReplace(selectedLoop_, down);
-                    }
-                    break;
-
-                case INSERT:
-                    if (mode_ == Rec)
-                    {
-                        sendInsert(selectedLoop_, down);
-                    }
-                    break;
-
-                case SUBSTITUTE:
-                    if (mode_ == Rec)
-                    {
-                        sendSubstitute(selectedLoop_, down);
-                    }
-                    break;
+    // /sl/<loop>/<kind> command, encoded on the stack
+    void sendOscCommand(int loop, const char* kind, const char* command)
+    {
+        char address[32];
+        snprintf(address, sizeof(address), "/sl/%d/%s", loop, kind);
+        OscPacket packet(address, "s");
+        packet.addString(command);
+        sendQueue_.post(oscSender, packet, OscSendQueue::EngineLane);
+    }
 
-                case MUTE:
-                    if (mode_ == Rec)
-                    {
-                        sendMuteSelected(down);
-                    }
-                    else if (down)
-                    {
-                        bool allMute = true;
-                        for (auto&& loop : loops_)
-                        {
-                            if (loop.state_ != Unknown && loop.state_ != Off &&
-                                loop.state_ != Muted && loop.state_ != Paused)
-                            {
-                                allMute = false;
-                                break;
-                            }
-                        }
+    // undo and clear act right away, everything else can wait for the boundary
+    static bool isQuantized(const char* command)
+    {
+        return strcmp(command, "undo") != 0 && strcmp(command, "undo_all") != 0;
+    }
 
-                        if (allMute)
-                        {
-                            sendTriggerAll();
-                            sendMuteOffAll(); // unmute any empty
-                                              // tracks that didn't trigger
-                        }
-                        else
-                        {
-                            sendMuteAll();
-                        }
-                    }
-                    break;
+    // asks the engine to answer on returnPath, behind the commands already queued
+    void sendPing(const char* returnPath)
+    {
+        char returnUrl[48];
+        snprintf(returnUrl, sizeof(returnUrl), "osc.udp://localhost:%d/", currentReceivePort_);
+        OscPacket packet("/ping", "ss");
+        packet.addString(returnUrl);
+        packet.addString(returnPath);
+        sendQueue_.post(oscSender, packet, OscSendQueue::EngineLane);
+    }
 
-                case UNDO:
-                    if (mode_ == Rec)
-                    {
-                        sendUndoSelected(down);
-                    }
-                    break;
+    // times a /ping round trip now and then, for the quantizer's transit time
+    // and the prediction timeouts
+    void probeTransit()
+    {
+        uint32 now = Time::getMillisecondCounter();
+        if (now - lastTransitProbe_ < TRANSIT_PROBE_INTERVAL)
+        {
+            return;
+        }
 
-                case RECORD:
-                    if (!down)
-                    {
-                        mode_ = mode_ == Rec ? Play : Rec;
-                    }
+        lastTransitProbe_ = now;
+        transitProbeSentAt_ = Time::getMillisecondCounterHiRes();
+        sendPing("/loop4r/rtt");
+    }
 
-                    if (mode_ == Rec)
-                    {
-                        ledOn(RECORD);
-                    }
-                    else
-                    {
-                        ledOff(RECORD);
-                    }
-                    break;
+    void handleIncomingMidiMessage(MidiInput* source, const MidiMessage& msg) override
+    {
+        LOOP4R_TRACE_SCOPE("handleIncomingMidiMessage");
+        LOOP4R_ALLOC_GUARD_SCOPE("handleIncomingMidiMessage");
+        // JUCE's ALSA timestamps only have ms resolution, too coarse to place
+        // the command within a JACK period or to track a clock with
+        double arrival = Time::getMillisecondCounterHiRes();
+        midiEventsIn_.fetch_add(1, std::memory_order_relaxed);
+        capture_.record(CaptureMidiIn, msg.getRawData(), msg.getRawDataSize());
 
-                default:
-                    break;
-            }
-            updateLoops();
+        // dozens of ticks a second, keep them off the pedal path and the log
+        if (msg.isMidiClock())
+        {
+            midiClock_.tick(arrival);
+            return;
+        }
 
-#if 0
-            switch (msg.getControllerNumber()) {
-                case 104: // 1-10 pedal down
-                    lastTime_ = (Time::getCurrentTime());
-                    if (pedalIdx >= 0 && pedalIdx <= 3)
-                    {
-                        sendMidiMessage(slMidiOut_, MidiMessage::noteOn(channel_, baseNote_+(int)mode_+pedalIdx, (uint8)127));
-                    }
-                    else if (pedalIdx == RECORD)
-                    {
-                        mode_ = mode_ == Play ? Rec : Play;
-                        if (mode_ == Play) {
-                            ledOff(pedalIdx);
-                        }
-                        else {
-                            ledOn(pedalIdx);
-                        }
-                        updateLoops();
-                    }
-                    else if (pedalIdx == UNDO)
-                    {
-                        ledOn(pedalIdx);
-                        sendMidiMessage(slMidiOut_, MidiMessage::noteOn(channel_, baseNote_+pedalIdx, (uint8)127));
-                    }
-                    else
-                    {
-                        sendMidiMessage(slMidiOut_, MidiMessage::noteOn(channel_, baseNote_+pedalIdx, (uint8)127));
-                    }
-                    break;
-                case 105:
-                    if (pedalIdx >= 0 && pedalIdx <= 3)
-                    {
-                        sendMidiMessage(slMidiOut_, MidiMessage::noteOff(channel_, baseNote_+(int)mode_+pedalIdx, (uint8)0));
-                    }
-                    else if (pedalIdx == RECORD)
-                    {
-                    }
-                    else if (pedalIdx == UNDO)
-                    {
-                        ledOff(pedalIdx);
-                        sendMidiMessage(slMidiOut_, MidiMessage::noteOff(channel_, baseNote_+pedalIdx, (uint8)0));
-                        updateLoops();
-                    }
-                    else
-                    {
-                        sendMidiMessage(slMidiOut_, MidiMessage::noteOff(channel_, baseNote_+pedalIdx, (uint8)0));
-                    }
-                    break;
-                default:
-                    if (slMidiOut_) {
-                        slMidiOut_->sendMessageNow(msg);
-                    }
-                break;
+        if (!filterCommands_.isEmpty())
+        {
+            bool filtered = false;
+            for (ApplicationCommand& cmd : filterCommands_)
+            {
+                switch (cmd.command_)
+                {
+                    case CHANNEL:
+                        channel_ = asDecOrHex7BitValue(cmd.opts_[0]);
+                        break;
+                    default:
+                        // no-op
+                        break;
+                }
+            }
+
+            if (!filtered)
+            {
+                return;
             }
-#endif
+        }
+
+        if (msg.isController()) {
+            int pedalIdx = pedalIndex(msg.getControllerValue());
+            bool down = msg.getControllerNumber() == 104 ? true : false;
+
+            // a replay feeds pedals from its own thread, so it has its own queue
+            controller_.post(source != nullptr ? midiEvents_ : replayEvents_,
+                             {LooperEvent::Pedal, pedalIdx, down ? 1 : 0, arrival});
         }
 
         if (msg.isNoteOn())
@@ -1039,9 +1026,11 @@ private:
         }
         else if (msg.isController())
         {
-            std::cerr << "channel "  << outputChannel(msg) << "   " <<
-            "control-change   " << output7Bit(msg.getControllerNumber()).paddedLeft(' ', 3) << " "
-            << output7Bit(msg.getControllerValue()).paddedLeft(' ', 3) << std::endl;
+            // every pedal press comes through here, so no Strings
+            char channel[8], number[8], value[8];
+            std::cerr << "channel "  << format7Bit(channel, sizeof(channel), msg.getChannel(), 2) << "   " <<
+            "control-change   " << format7Bit(number, sizeof(number), msg.getControllerNumber(), 3) << " "
+            << format7Bit(value, sizeof(value), msg.getControllerValue(), 3) << std::endl;
         }
         else if (msg.isProgramChange())
         {
@@ -1058,20 +1047,19 @@ private:
             std::cerr << "channel "  << outputChannel(msg) << "   " <<
             "pitch-bend       " << output14Bit(msg.getPitchWheelValue()).paddedLeft(' ', 7) << std::endl;
         }
-        else if (msg.isMidiClock())
-        {
-            std::cerr << "midi-clock" << std::endl;
-        }
         else if (msg.isMidiStart())
         {
+            midiClock_.start();
             std::cerr << "start" << std::endl;
         }
         else if (msg.isMidiStop())
         {
+            midiClock_.stop();
             std::cerr << "stop" << std::endl;
         }
         else if (msg.isMidiContinue())
         {
+            midiClock_.continuePlayback();
             std::cerr << "continue" << std::endl;
         }
         else if (msg.isActiveSense())
@@ -1110,6 +1098,7 @@ private:
         }
         else if (msg.isSongPositionPointer())
         {
+            midiClock_.songPosition(msg.getSongPositionPointerMidiBeat());
             std::cerr << "song-position " << output14Bit(msg.getSongPositionPointerMidiBeat()).paddedLeft(' ', 5) << std::endl;
         }
         else if (msg.getRawDataSize() == 2 && msg.getRawData()[0] == 0xf3)
@@ -1139,6 +1128,13 @@ private:
         }
     }
 
+    // output7Bit(v).paddedLeft(' ', width), written into buffer
+    const char* format7Bit(char* buffer, size_t size, int v, int width)
+    {
+        snprintf(buffer, size, useHexadecimalsByDefault_ ? "%*.2X" : "%*d", width, v);
+        return buffer;
+    }
+
     String output14BitAsHex(int v)
     {
         return String::toHexString(v).paddedLeft('0', 4).toUpperCase();
@@ -1224,8 +1220,9 @@ private:
         if (currentSendPort_ > 0 && currentReceivePort_ > 0) {
             if (!pinged_)
             {
-                oscSender.send("/ping", (String) "osc.udp://localhost:" + std::to_string(currentReceivePort_) + "/", (String) "/pingack");
+                sendPing("/pingack");
             }
+            startWatchdog();
             return true;
         }
 
@@ -1266,26 +1263,22 @@ private:
             }
         case FCB1010_OUT:
             {
-                int err;
-                midiOut_ = nullptr;
                 midiOutName_ = "hw:" + cmd.opts_[0] + ",0";
-                err = snd_rawmidi_open(NULL,&midiOut_, midiOutName_.toRawUTF8(), 0);
-                if (err)
+                if (ledOutput_.open(midiOutName_) < 0)
                 {
                     std::cerr << "Couldn't open MIDI output port \"" << midiOutName_ << "\"" << std::endl;
                 }
                 else
                 {
-                    // initialize the pedal leds to off
-                    for (auto i=0; i<NUM_LEDS; i++)
-                        ledOff(i);
+                    // show the leds as the core has them, all off unless a state was restored
+                    controller_.call([this] { core_.refreshLeds(); });
                 }
                 break;
             }
 
         case SL_OUT:
             {
-                slMidiOut_ = nullptr;
+                setSooperLooperMidiOut(nullptr);
                 slMidiOutName_ = cmd.opts_[0];
 
                 if (virtMidiOutName_.isNotEmpty())
@@ -1294,26 +1287,8 @@ private:
                     break;
                 }
 
-                int index = MidiOutput::getDevices().indexOf(slMidiOutName_);
-                if (index >= 0)
-                {
-                    slMidiOut_ = MidiOutput::openDevice(index);
-                }
-                else
-                {
-                    StringArray devices = MidiOutput::getDevices();
-                    for (int i = 0; i < devices.size(); ++i)
-                    {
-                        if (devices[i].containsIgnoreCase(slMidiOutName_))
-                        {
-                            slMidiOut_ = MidiOutput::openDevice(i);
-                            slMidiOutName_ = devices[i];
-                            break;
-                        }
-                    }
-                }
-
-                if (slMidiOut_ == nullptr)
+                setSooperLooperMidiOut(openSooperLooperMidiOut());
+                if (!slMidiOutOpen_)
                 {
                     std::cerr << "Couldn't find MIDI output port \"" << slMidiOutName_ << "\"" << std::endl;
                 }
@@ -1330,8 +1305,8 @@ private:
                     break;
                 }
 
-                slMidiOut_ = MidiOutput::createNewDevice(virtMidiOutName_);
-                if (slMidiOut_ == nullptr)
+                setSooperLooperMidiOut(MidiOutput::createNewDevice(virtMidiOutName_));
+                if (!slMidiOutOpen_)
                 {
                     std::cerr << "Couldn't create virtual MIDI output port \"" << virtMidiOutName_ << "\"" << std::endl;
                 }
@@ -1349,13 +1324,147 @@ private:
             if (! oscSender.connect ("127.0.0.1", oscSendPort_))
                 std::cerr << "Error: could not connect to UDP port " << cmd.opts_[0] << std::endl;
             else
+            {
                 currentSendPort_ = oscSendPort_;
+                if (isConnected())
+                    startWatchdog();
+            }
             break;
         case OSC_IN:
             oscReceivePort_ = asPortNumber(cmd.opts_[0]);
             if (!tryToConnectOsc())
                 std::cerr << "Error: could not connect to UDP port " << cmd.opts_[0] << std::endl;
             break;
+        case CAPTURE:
+            if (!capture_.start(File::getCurrentWorkingDirectory().getChildFile(cmd.opts_[0])))
+                std::cerr << "Error: could not open capture file " << cmd.opts_[0] << std::endl;
+            break;
+        case REPLAY:
+            if (cmd.opts_.isEmpty())
+            {
+                std::cerr << "Error: replay needs a capture file" << std::endl;
+                break;
+            }
+            // starts once the OSC ports are connected, see timerCallback()
+            replayFile_ = File::getCurrentWorkingDirectory().getChildFile(cmd.opts_[0]);
+            replaySpeed_ = cmd.opts_.size() > 1 ? cmd.opts_[1].getDoubleValue() : 1.0;
+            break;
+        case TRANSPORT:
+            transport_ = cmd.opts_[0].equalsIgnoreCase("midi") ? TransportMidi
+                       : cmd.opts_[0].equalsIgnoreCase("jack") ? TransportJack
+                       : TransportOsc;
+            if (transport_ == TransportMidi && slMidiOutName_.isEmpty() && virtMidiOutName_.isEmpty())
+                std::cerr << "Warning: the midi transport needs slout or vout, using OSC until then" << std::endl;
+            if (transport_ == TransportJack && !jackOut_.isOpen())
+                std::cerr << "Warning: the jack transport needs jack, using OSC until then" << std::endl;
+            break;
+        case JACK_OUT:
+            if (jackOut_.open("loop4r_control", cmd.opts_.isEmpty() ? String() : cmd.opts_[0]))
+                std::cerr << "Registered JACK MIDI output loop4r_control:commands" << std::endl;
+            break;
+        case BINDINGS:
+            if (!midiBindings_.load(File::getCurrentWorkingDirectory().getChildFile(cmd.opts_[0])))
+                std::cerr << "Error: could not read bindings file " << cmd.opts_[0] << std::endl;
+            else
+                std::cerr << "Loaded " << midiBindings_.size() << " note bindings from " << cmd.opts_[0] << std::endl;
+            break;
+        case METRICS:
+            if (cmd.opts_.isEmpty())
+            {
+                std::cerr << metrics_.toText();
+                break;
+            }
+            metricsFile_ = File::getCurrentWorkingDirectory().getChildFile(cmd.opts_[0]);
+            metricsInterval_ = cmd.opts_.size() > 1 ? jmax(1, cmd.opts_[1].getIntValue()) : DEFAULT_METRICS_INTERVAL;
+            lastMetricsWrite_ = Time::getMillisecondCounter() - (uint32) metricsInterval_ * 1000;
+            break;
+        case TRACE:
+           #if LOOP4R_TRACE
+            traceFile_ = File::getCurrentWorkingDirectory().getChildFile(cmd.opts_[0]);
+           #else
+            std::cerr << "Error: tracing is not compiled in, rebuild with LOOP4R_TRACE=1" << std::endl;
+           #endif
+            break;
+        case STATE:
+            {
+                File file = File::getCurrentWorkingDirectory().getChildFile(cmd.opts_[0]);
+                controller_.call([this, file]
+                {
+                    LooperSnapshot state;
+                    if (!snapshot_.open(file))
+                    {
+                        std::cerr << "Error: could not map state file " << file.getFullPathName() << std::endl;
+                    }
+                    else if (snapshot_.load(state))
+                    {
+                        core_.restoreState(state);
+                        restored_ = true;
+                        std::cerr << "Restored " << core_.getLoops().size() << " loops from " << file.getFullPathName() << std::endl;
+                    }
+                });
+                break;
+            }
+        case GESTURE:
+            {
+                String pedal = cmd.opts_[0];
+                int first = pedal.getIntValue() - 1;   // the pedals are numbered 1-10 on the board
+                int last = first;
+                if (pedal.equalsIgnoreCase("all"))
+                {
+                    first = 0;
+                    last = PedalGestures::maxPedals - 1;
+                }
+                else if (pedal.equalsIgnoreCase("tracks"))
+                {
+                    first = TRACK1;
+                    last = TRACK4;
+                }
+                else if (pedal.equalsIgnoreCase("up") || pedal.equalsIgnoreCase("down"))
+                {
+                    first = last = pedal.equalsIgnoreCase("up") ? UP : DOWN;
+                }
+                else if (!pedal.containsOnly("0123456789") || !isPositiveAndBelow(first, UNDO + 1))
+                {
+                    std::cerr << "Error: unknown pedal " << pedal << " for gesture" << std::endl;
+                    break;
+                }
+
+                PedalGestureConfig config;
+                config.debounceMs_ = jmax(0.0, cmd.opts_[1].getDoubleValue());
+                config.longPressMs_ = jmax(0.0, cmd.opts_[2].getDoubleValue());
+                config.doubleTapMs_ = jmax(0.0, cmd.opts_[3].getDoubleValue());
+                controller_.call([this, first, last, config]
+                {
+                    for (int i = first; i <= last; i++)
+                    {
+                        gestures_.setConfig(i, config);
+                    }
+                });
+                break;
+            }
+        case QUANTIZE:
+            for (auto m = 0; m < NumQuantizeModes; m++)
+            {
+                if (cmd.opts_[0].equalsIgnoreCase(quantizeModeNames[m]))
+                    quantizer_.setMode(static_cast<QuantizeMode>(m));
+            }
+            std::cerr << "Quantizing to " << quantizeModeNames[quantizer_.getMode()] << std::endl;
+            break;
+        case WATCHDOG:
+            watchdogWindow_ = jmax(20, cmd.opts_[0].getIntValue());
+            if (watchdog_.isRunning())
+                startWatchdog();
+            break;
+        case FAKE_ENGINE:
+            // listens where the controller sends, so give oout before fake
+            fakeEngine_.reset(new FakeSooperLooper());
+            if (!fakeEngine_->start(oscSendPort_,
+                                    cmd.opts_.size() > 0 ? cmd.opts_[0].getIntValue() : 8,
+                                    cmd.opts_.size() > 1 ? cmd.opts_[1].getIntValue() : 0))
+            {
+                fakeEngine_ = nullptr;
+            }
+            break;
         default:
             filterCommands_.add(cmd);
             break;
@@ -1493,125 +1602,50 @@ private:
         }
     }
 
-    void ledOn(int pedalIdx) {
-        int wrote;
-        LED& led = leds_.getReference(pedalIdx);
-        led.on_ = true;
-
-        //sendMidiMessage(midiOut_, MidiMessage::controllerEvent(channel_, 106, ledNumber(pedalIdx)));
-        unsigned char ch[]={MIDI_CMD_CONTROL, 106, ledNumber(pedalIdx)};
-        wrote = snd_rawmidi_write(midiOut_, &ch, sizeof(ch));
-        if (wrote != sizeof(ch))
-        {
-            std::cerr << "Could not write CC " << (int)106 << " " << (int)ledNumber(pedalIdx) << std::endl;
-        }
-
-        if (oscLedSenderInitialized_)
-        {
-            std::cout << "cc " << 106 << " " << (int)ledNumber(pedalIdx) << std::endl;
-            oscLedSender.send("/led", (int)led.index_, (int)(led.on_ ? 1 : 0), (int)led.timer_, (int)led.state_);
-        }
-    }
-
-    void ledOff(int pedalIdx) {
-        int wrote;
-        LED& led = leds_.getReference(pedalIdx);
-        led.on_ = false;
-        //sendMidiMessage(midiOut_, MidiMessage::controllerEvent(channel_, 107, ledNumber(pedalIdx)));
-        unsigned char ch[]={MIDI_CMD_CONTROL, 107, ledNumber(pedalIdx)};
-        wrote = snd_rawmidi_write(midiOut_, &ch, sizeof(ch));
-        if (wrote != sizeof(ch))
-        {
-            std::cerr << "Could not write CC " << (int)107 << " " << (int)ledNumber(pedalIdx) << std::endl;
-        }
-
-        if (oscLedSenderInitialized_)
-        {
-            std::cout << "cc " << 107 << " " << (int)ledNumber(pedalIdx) << std::endl;
-            oscLedSender.send("/led", (int)led.index_, (int)(led.on_ ? 1 : 0), (int)led.timer_, (int)led.state_);
-        }
-    }
-
-    void selectLoop() {
-        int wrote;
-        unsigned char ch[]={MIDI_CMD_CONTROL, 108, (unsigned char)(selectedLoop_ + 1)};
-        wrote = snd_rawmidi_write(midiOut_, &ch, sizeof(ch));
-        if (wrote != sizeof(ch))
-        {
-            std::cerr << "Could not write CC " << (int)108 << " " << (int)(selectedLoop_ + 1) << std::endl;
-        }
-
-        if (oscLedSenderInitialized_)
+    // Queues a message for the FCB1010, the scheduler decides when it goes
+    // out. It can't fail: a message replaces a pending one for the same LED.
+    void writeRawMidi(LedPriority priority, const unsigned char* data, size_t size)
+    {
+        capture_.record(CaptureLedOut, data, (int) size);
+        if (!ledOutput_.isOpen())
         {
-            std::cout << "cc " << 108 << " " << (int)(selectedLoop_ + 1) << std::endl;
-            oscLedSender.send("/display", (int)selectedLoop_);
+            return; // no FCB1010 output configured
         }
+        ledWrites_.fetch_add(1, std::memory_order_relaxed);
+        ledScheduler_.post(priority, data, (int) size);
     }
 
     void getCurrentState(int index)
     {
-        String buf = "/sl";
-        buf = buf + "/" + std::to_string(index) + "/get";
-        oscSender.send(buf,
-                       (String) "state",
-                       (String) "osc.udp://localhost:" + std::to_string(currentReceivePort_) + "/",
-                       (String) "/ctrl");
+        subscriptions_.queryLoop(index);
     }
 
     void getSelectedLoop()
     {
-        String buf = "/get";
-        oscSender.send(buf,
-                       (String) "selected_loop_num",
-                       (String) "osc.udp://localhost:" + std::to_string(currentReceivePort_) + "/",
-                       (String) "/ctrl");
+        subscriptions_.queryGlobal();
     }
 
     void registerAutoUpdates(int index, bool unreg)
     {
-        String buf = "/sl";
         if (unreg)
         {
-            buf = buf + "/" + std::to_string(index) + "/unregister_auto_update";
-            oscSender.send(buf,
-                           (String) "state",
-                           (int)100,
-                           (String) "osc.udp://localhost:" + std::to_string(currentReceivePort_) + "/",
-                           (String) "/ctrl");
+            subscriptions_.unsubscribeLoop(index);
         }
-        else{
-            buf = buf + "/" + std::to_string(index) + "/register_auto_update";
-            oscSender.send(buf,
-                           (String) "state",
-                           (int)100,
-                           (String) "osc.udp://localhost:" + std::to_string(currentReceivePort_) + "/",
-                           (String) "/ctrl");
+        else if (index < core_.getLoops().size())
+        {
+            subscriptions_.subscribeLoop(index, autoUpdateInterval(core_.getLoops().getReference(index)));
         }
+        core_.setUpdateInterval(index, subscriptions_.intervalFor(index));
     }
 
     void registerGlobalUpdates(bool unreg)
     {
-        String buf = "";
-        if (unreg)
-        {
-            buf = buf + "/unregister_update";
-            oscSender.send(buf,
-                           (String) "selected_loop_num",
-                           (String) "osc.udp://localhost:" + std::to_string(currentReceivePort_) + "/",
-                           (String) "/ctrl");
-        }
-        else{
-            buf = buf + "/register_update";
-            oscSender.send(buf,
-                           (String) "selected_loop_num",
-                           (String) "osc.udp://localhost:" + std::to_string(currentReceivePort_) + "/",
-                           (String) "/ctrl");
-        }
-
+        subscriptions_.subscribeGlobal(unreg);
     }
 
     void handlePingAckMessage(const OSCMessage& message)
     {
+        LOOP4R_TRACE_SCOPE("handlePingAckMessage");
         if (! message.isEmpty())
         {
             int i = 0;
@@ -1643,22 +1677,16 @@ private:
 
             if (loopCount_ > 0)
             {
-                loops_.clear();
-                for (i = 0; i < loopCount_; i++)
-                {
-                    loops_.add({i, Off, true, leds_.getReference(i)});
-                    registerAutoUpdates(i, false);
-                    getCurrentState(i);
-                }
+                resetLoops(loopCount_);
                 getSelectedLoop();
                 registerGlobalUpdates(false);
             }
-            heartbeat_ = 5; // we just heard from the looper
         }
     }
 
     void handleHeartbeatMessage(const OSCMessage& message)
     {
+        LOOP4R_TRACE_SCOPE("handleHeartbeatMessage");
         if (! message.isEmpty())
         {
             int i = 0;
@@ -1695,15 +1723,8 @@ private:
                 if (numloops > 0)
                 {
                     loopCount_ = numloops;
-                    loops_.clear();
-                    for (i = 0; i < loopCount_; i++)
-                    {
-                        loops_.add({i, Off, true, leds_.getReference(i)});
-                        registerAutoUpdates(i, false);
-                        getCurrentState(i);
-                    }
+                    resetLoops(loopCount_);
                     getSelectedLoop();
-                    updateLoops();
                     registerGlobalUpdates(false);
                 }
             }
@@ -1712,74 +1733,242 @@ private:
                 // check loopcount
                 if (loopCount_ != numloops)
                 {
+                    core_.addLoops(numloops);
                     for (auto i=loopCount_; i<numloops; i++)
                     {
                         registerAutoUpdates(i, false);
-                        loops_.add({i, Off, true, leds_.getReference(i)});
                     }
                     getSelectedLoop();
-                    updateLoops();
                     loopCount_ = numloops;
                 }
             }
-            heartbeat_ = 5; // we just heard from the looper
         }
     }
+    // Called on the OSC receiver thread with every datagram: decodes /ctrl in
+    // place, returns false for anything else so that the receiver parses it.
+    bool filterCtrlPacket(const char* data, int size)
+    {
+        OscPacketReader reader(data, size);
+        if (!reader.isValid() || strncmp(reader.getAddress(), "/ctrl", 5) != 0 || strncmp(reader.getTypes(), "isf", 3) != 0)
+        {
+            return false;
+        }
+
+        int loopIndex = reader.readInt32();
+        const char* control = reader.readString();
+        float value = reader.readFloat32();
+        if (!reader.isValid())
+        {
+            return false;
+        }
+
+        handleCtrl(loopIndex, control, value);
+        return true;
+    }
+
+    // Called on the OSC receiver thread with /ctrl messages the filter didn't take
     void handleCtrlMessage(const OSCMessage& message)
     {
-        if (! message.isEmpty())
+        if (message.size() < 3)
         {
-            OSCArgument* arg = message.begin();
-            int loopIndex = -1;
-            int loopState = 0;
-            if (arg->isInt32())
+            return;
+        }
+
+        const OSCArgument* arg = message.begin();
+        if (!arg[0].isInt32() || !arg[1].isString() || !arg[2].isFloat32())
+        {
+            std::cerr << "unrecognized format for ctrl message." << std::endl;
+            return;
+        }
+
+        handleCtrl(arg[0].getInt32(), arg[1].getString().toRawUTF8(), arg[2].getFloat32());
+    }
+
+    // Only stores the value in the control cache, the controller picks it up
+    // in controllerWoke().
+    void handleCtrl(int loopIndex, const char* name, float value)
+    {
+        LOOP4R_TRACE_SCOPE("handleCtrl");
+        LOOP4R_ALLOC_GUARD_SCOPE("handleCtrl");
+        bool wake = false;
+        if (loopIndex == -2)
+        {
+            // global control update
+            wake = controls_.setGlobal(controlIndex(globalControlNames, name), value);
+        }
+        else if (loopIndex >= 0)
+        {
+            int control = controlIndex(loopControlNames, name);
+            wake = controls_.setLoop(loopIndex, control, value);
+            if (control == CtrlLoopPos)
             {
-                loopIndex = arg->getInt32();
-                ++arg;
-            }
-            else {
-                std::cerr << "unrecognized format for ctrl message." << std::endl;
-                return;
+                quantizer_.observePosition(loopIndex, value, Time::getMillisecondCounterHiRes());
             }
+        }
+
+        if (wake)
+        {
+            controller_.wake();
+        }
+    }
+
+    //==============================================================================
+    // ControllerThread::Client: the controller thread owns the core and all
+    // that it sends
+
+    void controllerEvent(const LooperEvent& event) override
+    {
+        switch (event.type_)
+        {
+            case LooperEvent::Pedal:
+                gestures_.edge(event.index_, event.value_ != 0, event.timeMs_);
+                break;
+            case LooperEvent::Tick:
+                // blink the config led while the watchdog can't reach the engine
+                if (!engineAlive_)
+                {
+                    toggleHeartbeatLed();
+                }
+
+                core_.setRoundTrip(2.0 * quantizer_.getTransitMs());
+                core_.expirePredictions();
+
+                // back off loops that went idle since the last tick
+                adaptAutoUpdates();
+                probeTransit();
 
+                // handle pedal led state for blinking pedals, unless they follow the clock
+                if (!clockLocked_)
+                {
+                    core_.stepBlinks();
+                }
+                break;
+            default:
+                core_.handle(event);
+                break;
+        }
+    }
+
+    void controllerWoke() override
+    {
+        gestures_.expire(Time::getMillisecondCounterHiRes());
+        sendQuantized(Time::getMillisecondCounterHiRes());
+        applyEngineUpdates();
+        if (clockLocked_)
+        {
+            blinkToClock();
+        }
+
+        snapshot_.save(core_);
+        mispredictions_ = core_.getMispredictions();
+        loopsShown_ = core_.getLoops().size();
+        pedalChatter_ = gestures_.getChatterCount();
+    }
+
+    double controllerDeadline() override
+    {
+        double gesture = gestures_.nextDeadline();
+        double quantized = schedule_.nextDue();
+        return gesture > 0.0 && quantized > 0.0 ? jmin(gesture, quantized) : jmax(gesture, quantized);
+    }
+
+    // PedalGestures::Listener: presses go through right away, long presses
+    // and double taps follow up on them
+    void pedalEdge(int pedalIdx, bool down, double timeMs) override
+    {
+        LOOP4R_ALLOC_GUARD_SCOPE("pedal");
+        core_.pedal(pedalIdx, down, timeMs);
+    }
+
+    void pedalLongPress(int pedalIdx, double timeMs) override
+    {
+        core_.pedalLongPress(pedalIdx, timeMs);
+    }
+
+    void pedalDoubleTap(int pedalIdx, double timeMs) override
+    {
+        core_.pedalDoubleTap(pedalIdx, timeMs);
+    }
+
+    // Applies the engine updates that arrived since the last wake up, only the
+    // latest value of each control is seen here.
+    void applyEngineUpdates()
+    {
+        LOOP4R_TRACE_SCOPE("applyEngineUpdates");
+        LOOP4R_ALLOC_GUARD_SCOPE("applyEngineUpdates");
+        bool heard = controls_.drain([this] (int loopIndex, uint32 dirty)
+        {
             if (loopIndex == -2)
             {
-                // global control update
-                if (arg->isString() && arg->getString() == "selected_loop_num")
+                if (dirty & (1u << CtrlSelectedLoopNum))
                 {
-                    ++arg;
-                    if (arg->isFloat32())
-                    {
-                        selectedLoop_ = arg->getFloat32();
-                        selectLoop();
-                    }
+                    core_.engineSelectedLoop((int) controls_.getGlobal(CtrlSelectedLoopNum));
                 }
             }
-            else if (loopIndex < 0) {
-                return;
-            }
-            else
+            else if (dirty & (1u << CtrlState))
             {
-                if (arg->isString())
-                {
-                    if (arg->getString() == "state")
-                    {
-                        ++arg;
-                        if (arg->isFloat32())
-                        {
-                            loopState = arg->getFloat32();
-                            Loop &loop = loops_.getReference(loopIndex);
-                            updateLoopLedState(loop, static_cast<LoopStates>(loopState));
-                        }
-                    }
-                }
-                heartbeat_ = 5; // we just heard from the looper
+                core_.engineLoopState(loopIndex, static_cast<LoopStates>((int) controls_.getLoop(loopIndex, CtrlState)));
             }
+        });
+
+        if (heard)
+        {
+            adaptAutoUpdates();
+        }
+    }
+
+    // Writes the trace spans recorded so far to the trace command's file
+    void writeTrace()
+    {
+       #if LOOP4R_TRACE
+        if (traceFile_ == File())
+        {
+            return;
+        }
+
+        if (loop4rTrace::dump(traceFile_.getFullPathName().toRawUTF8()))
+            std::cerr << "Wrote trace to " << traceFile_.getFullPathName() << std::endl;
+        else
+            std::cerr << "Error: could not write trace to " << traceFile_.getFullPathName() << std::endl;
+       #endif
+    }
+
+    // /loop4r/metrics host port path: replies on path with the metrics text
+    void handleMetricsMessage(const OSCMessage& message)
+    {
+        LOOP4R_TRACE_SCOPE("handleMetricsMessage");
+        if (message.size() < 3 || !message[0].isString() || !message[1].isInt32() || !message[2].isString())
+        {
+            std::cerr << "Error: /loop4r/metrics needs host, port and path" << std::endl;
+            return;
+        }
+
+        OSCSender sender;
+        if (!sender.connect(message[0].getString(), message[1].getInt32())
+            || !sender.send(message[2].getString(), metrics_.toText()))
+        {
+            std::cerr << "Error: could not send metrics to " << message[0].getString() << ":" << message[1].getInt32() << std::endl;
+        }
+    }
+
+    void writeMetricsFile()
+    {
+        uint32 now = Time::getMillisecondCounter();
+        if (metricsFile_ == File() || now - lastMetricsWrite_ < (uint32) metricsInterval_ * 1000)
+        {
+            return;
+        }
+
+        lastMetricsWrite_ = now;
+        if (!metrics_.writeTextFile(metricsFile_))
+        {
+            std::cerr << "Error: could not write metrics to " << metricsFile_.getFullPathName() << std::endl;
         }
     }
 
     void handlePingMessage(const OSCMessage& message)
     {
+        LOOP4R_TRACE_SCOPE("handlePingMessage");
         if (! message.isEmpty())
         {
             String host;
@@ -1809,7 +1998,7 @@ private:
                         }
 
                         if (! sender.send(url, (String)"osc.udp://localhost:" + std::to_string(oscReceivePort_),
-                                    (String)getApplicationVersion(), (int)leds_.size(), (int)getuid()))
+                                    (String)getApplicationVersion(), (int)NUM_LEDS, (int)getuid()))
                         {
                             std::cerr << "Error: could not send to UDP " << host << ":" << port << std::endl;
                         }
@@ -1824,6 +2013,7 @@ private:
 
     void handleLedsMessage(const OSCMessage& message)
     {
+        LOOP4R_TRACE_SCOPE("handleLedsMessage");
         if (! message.isEmpty())
         {
             String host;
@@ -1851,7 +2041,7 @@ private:
                             std::cerr << "Error: could not connect to UDP " << host << ":" << port << std::endl;
                             return;
                         }
-                        for (auto&& led : leds_)
+                        for (auto&& led : core_.getLeds())
                         {
                             sender.send(url, (int)led.index_, (int)(led.on_ ? 1 : 0), (int)led.timer_, (int)led.state_);
                         }
@@ -1866,6 +2056,7 @@ private:
 
     void handleDisplayMessage(const OSCMessage& message)
     {
+        LOOP4R_TRACE_SCOPE("handleDisplayMessage");
         if (! message.isEmpty())
         {
             String host;
@@ -1894,7 +2085,7 @@ private:
                             return;
                         }
 
-                        sender.send("/display", (int)selectedLoop_);
+                        sender.send("/display", (int)core_.getSelectedLoop());
                         sender.disconnect();
                     }
                 }
@@ -1905,6 +2096,7 @@ private:
 
     void handleRegisterAutoUpdateMessage(const OSCMessage& message, bool unreg)
     {
+        LOOP4R_TRACE_SCOPE("handleRegisterAutoUpdateMessage");
         if (! message.isEmpty())
         {
             OSCArgument* arg = message.begin();
@@ -1965,8 +2157,32 @@ private:
             }
     }
 
+    // Called on the OSC receiver thread. Engine /ctrl updates only land in the
+    // control cache, everything else is handled on the controller thread.
     void oscMessageReceived (const OSCMessage& message) override
     {
+        LOOP4R_TRACE_SCOPE("oscMessageReceived");
+        if (message.getAddressPattern().toString().startsWith("/ctrl"))
+        {
+            handleCtrlMessage(message);
+            return;
+        }
+        if (message.getAddressPattern().toString().startsWith("/loop4r/alive"))
+        {
+            return; // watchdog probe reply, the packet handler already saw it
+        }
+        if (message.getAddressPattern().toString().startsWith("/loop4r/rtt"))
+        {
+            quantizer_.addRoundTrip(Time::getMillisecondCounterHiRes() - transitProbeSentAt_);
+            return;
+        }
+
+        controller_.call([this, message] { handleOscMessage(message); });
+    }
+
+    void handleOscMessage (const OSCMessage& message)
+    {
+        LOOP4R_TRACE_SCOPE("handleOscMessage");
         if (!message.getAddressPattern().toString().startsWith("/heartbeat") && !message.getAddressPattern().toString().startsWith("/loop4r/ping") )
         {
             std::cerr << "-" <<
@@ -2015,14 +2231,18 @@ private:
         {
             handlePingAckMessage(message);
         }
-        else if (message.getAddressPattern().toString().startsWith("/ctrl"))
-        {
-            handleCtrlMessage(message);
-        }
         else if (message.getAddressPattern().toString().startsWith("/heartbeat"))
         {
             handleHeartbeatMessage(message);
         }
+        else if (message.getAddressPattern().toString().startsWith("/loop4r/metrics"))
+        {
+            handleMetricsMessage(message);
+        }
+        else if (message.getAddressPattern().toString().startsWith("/loop4r/trace"))
+        {
+            writeTrace();
+        }
         else if (message.getAddressPattern().toString().startsWith("/loop4r/ping"))
         {
             handlePingMessage(message);
@@ -2060,9 +2280,24 @@ private:
             return;
         }
 
+        // the receiver thread reads these without a lock, so they have to be
+        // in place before it starts
+        oscReceiver.registerPacketHandler ([this] (const char* data, int size)
+                                           {
+                                               watchdog_.heard();
+                                               oscDatagramsIn_.fetch_add(1, std::memory_order_relaxed);
+                                               capture_.record(CaptureOscIn, data, size);
+                                           });
+        oscReceiver.registerPacketFilter ([this] (const char* data, int size)
+                                          {
+                                              return filterCtrlPacket(data, size);
+                                          });
+
         if (oscReceiver.connect (portToConnect))
         {
             currentReceivePort_ = portToConnect;
+            String returnUrl = "osc.udp://localhost:" + String(currentReceivePort_) + "/";
+            controller_.call([this, returnUrl] { subscriptions_.setReturnUrl(returnUrl); });
             oscReceiver.addListener (this);
             oscReceiver.registerFormatErrorHandler ([this] (const char* data, int dataSize)
                                                     {
@@ -2115,6 +2350,24 @@ private:
         return port > 0 && port < 65536;
     }
 
+    // the loop4r unit tests, in a build with JUCE_UNIT_TESTS=1
+    void runUnitTests()
+    {
+       #if JUCE_UNIT_TESTS
+        UnitTestRunner runner;
+        runner.runTestsInCategory("loop4r");
+        int failures = 0;
+        for (auto i = 0; i < runner.getNumResults(); i++)
+        {
+            failures += runner.getResult(i)->failures;
+        }
+        setApplicationReturnValue(failures == 0 ? 0 : 1);
+       #else
+        std::cerr << "Error: --test needs a build with JUCE_UNIT_TESTS=1" << std::endl;
+        setApplicationReturnValue(1);
+       #endif
+    }
+
     void printVersion()
     {
         std::cerr << ProjectInfo::projectName << " v" << ProjectInfo::versionString << std::endl;
@@ -2143,6 +2396,7 @@ private:
         }
         std::cerr << "  -h  or  --help       Print Help (this message) and exit" << std::endl;
         std::cerr << "  --version            Print version information and exit" << std::endl;
+        std::cerr << "  --test               Run the unit tests and exit, needs a JUCE_UNIT_TESTS=1 build" << std::endl;
         std::cerr << "  --                   Read commands from standard input until it's closed" << std::endl;
         std::cerr << std::endl;
         std::cerr << "Alternatively, you can use the following long versions of the commands:" << std::endl;
@@ -2171,10 +2425,23 @@ private:
         std::cerr << std::endl;
     }
 
+    // controller thread only, see controller_
+    SystemClock clock_;
+    LooperCore core_ { *this, clock_ };
+    PedalGestures gestures_ { *this };
+    StateSnapshot snapshot_;
+    bool restored_ = false;     // the loops came from the snapshot, not the engine
+    std::atomic<int64> mispredictions_ { 0 };  // the core's, as of the controller's last wake up
+    std::atomic<int> loopsShown_ { 0 };
+    std::atomic<int64> pedalChatter_ { 0 };
+
     OSCReceiver oscReceiver;
     OSCSender oscSender;
     OSCSender oscLedSender;
     bool oscLedSenderInitialized_ = false;
+    LoopControlCache controls_;
+    OscSendQueue sendQueue_;    // everything the controller sends goes out from here
+    EngineSubscriptions subscriptions_ { oscSender, sendQueue_ };
 
     int currentReceivePort_ = -1;
     int currentSendPort_ = -1;
@@ -2187,8 +2454,6 @@ private:
     int oscRemotePort_;
     int engineId_;
 
-    Array<Loop> loops_;
-    Array<LED> leds_;
     Array<ApplicationCommand> commands_;
     Array<ApplicationCommand> filterCommands_;
 
@@ -2201,24 +2466,64 @@ private:
     String fullMidiInName_;
 
     String midiOutName_;
-    snd_rawmidi_t *midiOut_ = 0;
+    RawMidiOutput ledOutput_;
+    LedScheduler ledScheduler_ { ledOutput_ };
+    int64 reportedLedDrops_ = 0;
     String fullMidiOutName_;
 
     String slMidiOutName_;
     String virtMidiOutName_;
-    ScopedPointer<MidiOutput> slMidiOut_;
+    ScopedPointer<MidiOutput> slMidiOut_;   // controller thread only, see setSooperLooperMidiOut()
+    MidiBuffer hitNotes_;                   // a /hit's press and release, sized once
+    bool slMidiOutOpen_ = false;            // whether the message thread handed one over
+    JackMidiOutput jackOut_;
+    MidiClockTracker midiClock_;
+    std::atomic<bool> clockLocked_ { false };
+    CommandQuantizer quantizer_ { controls_, midiClock_ };
+    CommandSchedule schedule_;  // controller thread only
+    uint32 lastTransitProbe_ = 0;
+    std::atomic<double> transitProbeSentAt_ { 0.0 };
+
+    MetricsRegistry metrics_;
+    std::atomic<int64> midiEventsIn_ { 0 };
+    std::atomic<int64> oscDatagramsIn_ { 0 };
+    std::atomic<int64> oscDatagramsOut_ { 0 };
+    std::atomic<int64> ledWrites_ { 0 };
+    std::atomic<int64> engineLosses_ { 0 };
+    std::atomic<int64> engineReconnects_ { 0 };
+    File metricsFile_;
+    int metricsInterval_ = DEFAULT_METRICS_INTERVAL;
+    uint32 lastMetricsWrite_ = 0;
+    File traceFile_;
 
     int loopCount_;
-    int selectedLoop_;
     bool pinged_;
     String hostUrl_;
     String version_;
-    int heartbeat_;
-    bool heartbeatOn_ = false;
-    Modes mode_ = Play;
+    bool heartbeatOn_ = false;  // controller thread only
+    std::atomic<bool> engineAlive_ { false };
+    Transport transport_ = TransportOsc;
+    MidiBindings midiBindings_;
+    TransportStats dispatchStats_[NumTransports]; // time spent sending a command
+    TransportStats confirmStats_[NumTransports];  // pedal press to the confirming /ctrl
 
     ApplicationCommand currentCommand_;
     Time lastTime_;
+
+    SessionCapture capture_;
+    std::unique_ptr<SessionReplay> replay_;
+    std::unique_ptr<FakeSooperLooper> fakeEngine_;
+    ConnectionWatchdog watchdog_ { "SooperLooper" };
+    int watchdogWindow_ = ConnectionWatchdog::defaultWindowMs;
+    File replayFile_;
+    double replaySpeed_ = 1.0;
+    DatagramSocket replaySocket_;
+
+    // last, so that it stops before anything it uses goes away
+    LooperEventQueue midiEvents_;      // pedals from the MIDI input thread
+    LooperEventQueue replayEvents_;    // pedals from a replay, on its own thread
+    LooperEventQueue timerEvents_;     // ticks from the message thread
+    ControllerThread controller_ { *this };
 };
 
 //==============================================================================
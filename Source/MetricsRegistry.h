@@ -0,0 +1,87 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <functional>
+#include <vector>
+
+/*
+ ==============================================================================
+ The controller's metrics, in the Prometheus text exposition format.
+
+ The registry doesn't hold any values itself: each metric reads a counter
+ its owner already keeps (usually a relaxed std::atomic), so updating one
+ costs no more than that increment. Reads happen when the text is produced,
+ on the message thread for the metrics file and on the OSC thread for
+ /loop4r/metrics, so every reader has to be safe to call from any thread.
+ ==============================================================================
+ */
+class MetricsRegistry
+{
+public:
+    using Reader = std::function<double()>;
+
+    MetricsRegistry() {}
+
+    void addCounter(const String& name, const String& help, Reader read)
+    {
+        metrics_.push_back({name, help, true, std::move(read)});
+    }
+
+    void addGauge(const String& name, const String& help, Reader read)
+    {
+        metrics_.push_back({name, help, false, std::move(read)});
+    }
+
+    String toText() const
+    {
+        String text;
+        for (auto&& metric : metrics_)
+        {
+            double value = metric.read_();
+            text << "# HELP " << metric.name_ << " " << metric.help_ << "\n"
+                 << "# TYPE " << metric.name_ << (metric.counter_ ? " counter" : " gauge") << "\n"
+                 << metric.name_ << " "
+                 << (value == std::floor(value) ? String((int64) value) : String(value, 3)) << "\n";
+        }
+        return text;
+    }
+
+    // Writes the text next to file and renames it into place, so a collector
+    // reading the directory never sees a partial file.
+    bool writeTextFile(const File& file) const
+    {
+        File temp = file.getSiblingFile("." + file.getFileName() + ".tmp");
+        return temp.replaceWithText(toText()) && temp.replaceFileIn(file);
+    }
+
+private:
+    struct Metric
+    {
+        String name_;
+        String help_;
+        bool counter_;
+        Reader read_;
+    };
+
+    std::vector<Metric> metrics_;
+
+    JUCE_DECLARE_NON_COPYABLE(MetricsRegistry)
+};
@@ -0,0 +1,122 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// the bindings from loop4r.slb, used unless another file is loaded
+static const char* const defaultMidiBindings =
+    "0 n 64  note mute_trigger 0  0 1  norm 0 127 0\n"
+    "0 n 65  note mute_trigger 1  0 1  norm 0 127 0\n"
+    "0 n 66  note mute_trigger 2  0 1  norm 0 127 0\n"
+    "0 n 67  note mute_trigger 3  0 1  norm 0 127 0\n"
+    "0 on 68  set select_next_loop -2  0 1  norm 0 127 0\n"
+    "0 n 69  note multiply -3  0 1  norm 0 127 0\n"
+    "0 n 70  note insert -3  0 1  norm 0 127 0\n"
+    "0 n 71  note replace -3  0 1  norm 0 127 0\n"
+    "0 n 72  note substitute -3  0 1  norm 0 127 0\n"
+    "0 n 73  note undo -3  0 1  norm 0 127 0\n"
+    "0 n 74  note undo_all -1  0 1  norm 0 127 0\n"
+    "0 n 75  note mute_on -1  0 1  norm 0 127 0\n"
+    "0 n 84  note record_or_overdub_excl 0  0 1  norm 0 127 0\n"
+    "0 n 85  note record_or_overdub_excl 1  0 1  norm 0 127 0\n"
+    "0 n 86  note record_or_overdub_excl 2  0 1  norm 0 127 0\n"
+    "0 n 87  note record_or_overdub_excl 3  0 1  norm 0 127 0\n"
+    "0 cc 102  set dry -2  0 1  norm 0 127 0\n"
+    "0 cc 103  set wet -2  0 1  norm 0 127 0\n";
+
+/*
+ ==============================================================================
+ The note bindings of a SooperLooper .slb file, looked up by command and loop
+ so pedal commands can be sent as MIDI notes instead of OSC.
+
+ Each line reads: channel type number  kind command loop  ...
+ where type is n (note), on (note on only) or cc. Only the note bindings for
+ SooperLooper commands ("note" kind) are kept.
+ ==============================================================================
+ */
+class MidiBindings
+{
+public:
+    struct Binding
+    {
+        int channel_;   // 1-16
+        int note_;
+        String command_;
+        int loop_;      // -1 all, -3 selected, else the loop index
+    };
+
+    MidiBindings()
+    {
+        parse(defaultMidiBindings);
+    }
+
+    bool load(const File& file)
+    {
+        if (!file.existsAsFile())
+        {
+            return false;
+        }
+        parse(file.loadFileAsString());
+        return true;
+    }
+
+    void parse(const String& text)
+    {
+        bindings_.clear();
+
+        StringArray lines;
+        lines.addLines(text);
+        for (auto&& line : lines)
+        {
+            StringArray tokens;
+            tokens.addTokens(line, true);
+            tokens.removeEmptyStrings();
+            if (tokens.size() < 6 || tokens[1] != "n" || tokens[3] != "note")
+            {
+                continue;
+            }
+            bindings_.add({tokens[0].getIntValue() + 1, tokens[2].getIntValue(), tokens[4], tokens[5].getIntValue()});
+        }
+    }
+
+    // nullptr if the command isn't bound for that loop
+    const Binding* find(const char* command, int loop) const
+    {
+        // a dozen or two entries, a scan beats hashing the command name
+        for (auto&& binding : bindings_)
+        {
+            if (binding.loop_ == loop && binding.command_ == command)
+            {
+                return &binding;
+            }
+        }
+        return nullptr;
+    }
+
+    int size() const
+    {
+        return bindings_.size();
+    }
+
+private:
+    Array<Binding> bindings_;
+
+    JUCE_DECLARE_NON_COPYABLE(MidiBindings)
+};
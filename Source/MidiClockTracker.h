@@ -0,0 +1,161 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/*
+ ==============================================================================
+ Follows an external MIDI clock (24 ticks per quarter note).
+
+ The tick times are filtered by a second order delay-locked loop, which
+ averages out the jitter of the MIDI link and the scheduler while still
+ following tempo changes within a second or so. The tick handlers are called
+ on the MIDI thread, the getters from anywhere.
+ ==============================================================================
+ */
+class MidiClockTracker
+{
+public:
+    static const int ticksPerBeat = 24;
+
+    // one tick every 125 ms is 20 bpm, anything slower counts as a dropout
+    static constexpr double maxTickMs = 125.0;
+
+    MidiClockTracker(double bandwidthHz = 1.0) : bandwidthHz_(bandwidthHz) {}
+
+    // a clock tick that arrived at timeMs (Time::getMillisecondCounterHiRes())
+    void tick(double timeMs)
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+
+        if (ticks_ == 0 || timeMs - lastTick_ > maxTickMs)
+        {
+            // (re)start from scratch, the period needs a second tick
+            ticks_ = 1;
+        }
+        else if (ticks_ == 1)
+        {
+            period_ = timeMs - lastTick_;
+            filtered_ = timeMs;
+            predicted_ = timeMs + period_;
+            ticks_++;
+        }
+        else
+        {
+            // the loop error, with single late or early ticks limited to half a period
+            double error = jlimit(-0.5 * period_, 0.5 * period_, timeMs - predicted_);
+            double omega = 2.0 * double_Pi * bandwidthHz_ * period_ * 0.001;
+
+            filtered_ = predicted_;
+            predicted_ += std::sqrt(2.0) * omega * error + period_;
+            period_ += omega * omega * error;
+            ticks_++;
+        }
+
+        // the clock keeps ticking while stopped, the song doesn't move
+        lastTick_ = timeMs;
+        if (running_)
+        {
+            position_ = nextPosition_++;
+        }
+    }
+
+    // Start: the next tick is the first of the song
+    void start()
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        nextPosition_ = 0;
+        running_ = true;
+    }
+
+    void stop()
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        running_ = false;
+    }
+
+    // Continue: carry on from the last tick or song position
+    void continuePlayback()
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        running_ = true;
+    }
+
+    // Song Position Pointer, in sixteenth notes
+    void songPosition(int sixteenths)
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        nextPosition_ = (int64) sixteenths * (ticksPerBeat / 4);
+    }
+
+    // locked once a beat's worth of ticks went through the loop, until they stop coming
+    bool isLocked(double nowMs) const
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        return locked(nowMs);
+    }
+
+    bool isRunning() const
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        return running_;
+    }
+
+    // in beats per minute, 0 when not locked
+    double getTempo(double nowMs) const
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        return locked(nowMs) ? 60000.0 / (period_ * ticksPerBeat) : 0.0;
+    }
+
+    // beats since Start (or the song position) at nowMs, -1 when not locked
+    // or stopped
+    double getBeatPosition(double nowMs) const
+    {
+        const SpinLock::ScopedLockType sl(lock_);
+        if (!locked(nowMs) || !running_)
+        {
+            return -1.0;
+        }
+
+        // never run past the next tick, it may be late
+        double sinceTick = jlimit(0.0, 1.0, (nowMs - filtered_) / period_);
+        return (position_ + sinceTick) / ticksPerBeat;
+    }
+
+private:
+    bool locked(double nowMs) const
+    {
+        return ticks_ >= ticksPerBeat && nowMs - lastTick_ <= maxTickMs;
+    }
+
+    double bandwidthHz_;
+    mutable SpinLock lock_;
+    int64 ticks_ = 0;           // ticks since the loop (re)started
+    double lastTick_ = 0.0;     // raw time of the last tick
+    double filtered_ = 0.0;     // filtered time of the last tick
+    double predicted_ = 0.0;    // filtered time of the next tick
+    double period_ = 0.0;       // filtered ms per tick
+    int64 position_ = 0;        // ticks since Start
+    int64 nextPosition_ = 0;
+    bool running_ = true;       // until a Stop, a clock without Start counts as running
+
+    JUCE_DECLARE_NON_COPYABLE(MidiClockTracker)
+};
@@ -0,0 +1,192 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/*
+ ==============================================================================
+ OSC messages encoded into and decoded from fixed size buffers, for the
+ messages sent or received on every pedal press and engine update: building
+ an OSCMessage allocates for the address, each string argument and the
+ encoded packet.
+
+ The type tags are given up front and the arguments added in that order;
+ a packet that would overflow is marked invalid and won't be sent.
+ ==============================================================================
+ */
+class OscPacket
+{
+public:
+    static const int capacity = 256;
+
+    // e.g. OscPacket("/set", "si") followed by addString() and addInt32()
+    OscPacket(const char* address, const char* types)
+    {
+        writeString(address);
+        writeByte(',');
+        writeString(types);
+        types_ = types;
+    }
+
+    void addInt32(int32 value)
+    {
+        checkType('i');
+        writeBigEndian((uint32) value);
+    }
+
+    void addFloat32(float value)
+    {
+        checkType('f');
+        uint32 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writeBigEndian(bits);
+    }
+
+    void addString(const char* value)
+    {
+        checkType('s');
+        writeString(value);
+    }
+
+    bool isValid() const        { return valid_ && *types_ == 0; }
+    const char* getData() const { return data_; }
+    int getSize() const         { return size_; }
+
+    bool send(OSCSender& sender) const
+    {
+        return isValid() && sender.sendPacket(data_, (size_t) size_);
+    }
+
+private:
+    void checkType(char type)
+    {
+        // arguments have to be added in the order of the type tags
+        jassert(*types_ == type);
+        if (*types_ != type)
+        {
+            valid_ = false;
+            return;
+        }
+        types_++;
+    }
+
+    void writeByte(char c)
+    {
+        if (size_ < capacity)
+            data_[size_++] = c;
+        else
+            valid_ = false;
+    }
+
+    // zero terminated and padded to a multiple of 4
+    void writeString(const char* s)
+    {
+        while (*s != 0)
+        {
+            writeByte(*s++);
+        }
+        do
+        {
+            writeByte(0);
+        } while ((size_ & 3) != 0);
+    }
+
+    void writeBigEndian(uint32 value)
+    {
+        writeByte((char) (value >> 24));
+        writeByte((char) (value >> 16));
+        writeByte((char) (value >> 8));
+        writeByte((char) value);
+    }
+
+    char data_[capacity];
+    int size_ = 0;
+    const char* types_;
+    bool valid_ = true;
+};
+
+//==============================================================================
+// Reads a single OSC message in place, the strings point into the packet.
+class OscPacketReader
+{
+public:
+    OscPacketReader(const char* data, int size)
+    : data_(data), size_(size)
+    {
+        address_ = readString();
+        const char* tags = readString();
+        valid_ = valid_ && tags[0] == ',';
+        types_ = valid_ ? tags + 1 : "";
+    }
+
+    bool isValid() const            { return valid_; }
+    const char* getAddress() const  { return valid_ ? address_ : ""; }
+    const char* getTypes() const    { return types_; }  // without the ','
+
+    int32 readInt32()
+    {
+        return (int32) readBigEndian();
+    }
+
+    float readFloat32()
+    {
+        uint32 bits = readBigEndian();
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    const char* readString()
+    {
+        const char* s = data_ + pos_;
+        int length = 0;
+        while (pos_ + length < size_ && s[length] != 0)
+        {
+            length++;
+        }
+        if (pos_ + length >= size_)
+        {
+            valid_ = false;
+            return "";
+        }
+        pos_ = jmin(size_, pos_ + ((length + 4) & ~3));
+        return s;
+    }
+
+private:
+    uint32 readBigEndian()
+    {
+        if (pos_ + 4 > size_)
+        {
+            valid_ = false;
+            return 0;
+        }
+        const uint8* p = reinterpret_cast<const uint8*>(data_ + pos_);
+        pos_ += 4;
+        return ((uint32) p[0] << 24) | ((uint32) p[1] << 16) | ((uint32) p[2] << 8) | (uint32) p[3];
+    }
+
+    const char* data_;
+    int size_;
+    int pos_ = 0;
+    const char* address_ = "";
+    const char* types_ = "";
+    bool valid_ = true;
+};
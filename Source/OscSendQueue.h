@@ -0,0 +1,246 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OscPacket.h"
+#include <atomic>
+#include <memory>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*
+ ==============================================================================
+ Sends encoded OSC packets from a thread of its own, so that no caller waits
+ for a socket, least of all the controller on a slow LED mirror client.
+
+ There are two lanes, each a bounded multi-producer queue that takes no locks:
+ the engine lane for commands and registrations, which is always emptied
+ first and never drops, and the mirror lane for the LED mirror and other
+ diagnostics, which drops packets when it's full. When the engine lane is
+ full, post() waits for room rather than reorder the engine's commands.
+ ==============================================================================
+ */
+class OscSendQueue : private Thread
+{
+public:
+    enum Lane
+    {
+        EngineLane,
+        MirrorLane,
+        NumLanes
+    };
+
+    OscSendQueue()
+    : Thread("osc send"), lanes_ { { engineCapacity }, { mirrorCapacity } },
+      wakeFd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+    }
+
+    ~OscSendQueue()
+    {
+        stop();
+        if (wakeFd_ >= 0)
+        {
+            ::close(wakeFd_);
+        }
+    }
+
+    void start()
+    {
+        if (isThreadRunning())
+        {
+            return;
+        }
+        startThread(8);
+    }
+
+    // sends what's left in the engine lane, then stops
+    void stop()
+    {
+        if (!isThreadRunning())
+        {
+            return;
+        }
+        signalThreadShouldExit();
+        wake();
+        stopThread(1000);
+    }
+
+    // Queues packet for target, safe to call from any thread. Returns false
+    // if it was dropped or couldn't be sent.
+    bool post(OSCSender& target, const OscPacket& packet, Lane lane)
+    {
+        if (!packet.isValid())
+        {
+            return false;
+        }
+        if (!isThreadRunning())
+        {
+            return packet.send(target);
+        }
+
+        Ring& ring = lanes_[lane];
+        while (!ring.push(target, packet))
+        {
+            if (lane != EngineLane)
+            {
+                drops_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            wake();
+            Thread::yield();
+        }
+        wake();
+        return true;
+    }
+
+    // mirror packets dropped on a full lane
+    int64 getDropCount() const
+    {
+        return drops_;
+    }
+
+private:
+    static const uint32 engineCapacity = 256;
+    static const uint32 mirrorCapacity = 128;
+
+    // Bounded queue after Dmitry Vyukov's: each slot's sequence says whether
+    // it's free for the producer at that position or ready for the consumer.
+    class Ring
+    {
+    public:
+        Ring(uint32 capacity)
+        : mask_(capacity - 1), slots_(new Slot[capacity])
+        {
+            jassert(isPowerOfTwo(capacity));
+            for (uint32 i = 0; i < capacity; i++)
+            {
+                slots_[i].sequence_.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool push(OSCSender& target, const OscPacket& packet)
+        {
+            uint32 pos = enqueuePos_.load(std::memory_order_relaxed);
+            Slot* slot;
+            for (;;)
+            {
+                slot = &slots_[pos & mask_];
+                int32 diff = (int32) (slot->sequence_.load(std::memory_order_acquire) - pos);
+                if (diff == 0)
+                {
+                    if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false; // full
+                }
+                else
+                {
+                    pos = enqueuePos_.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->target_ = &target;
+            slot->size_ = packet.getSize();
+            memcpy(slot->data_, packet.getData(), (size_t) packet.getSize());
+            slot->sequence_.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side: sends the oldest packet, false if there is none
+        bool sendNext()
+        {
+            Slot& slot = slots_[dequeuePos_ & mask_];
+            if (slot.sequence_.load(std::memory_order_acquire) != dequeuePos_ + 1)
+            {
+                return false;
+            }
+
+            slot.target_->sendPacket(slot.data_, (size_t) slot.size_);
+            slot.sequence_.store(dequeuePos_ + mask_ + 1, std::memory_order_release);
+            dequeuePos_++;
+            return true;
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint32> sequence_;
+            OSCSender* target_;
+            int size_;
+            char data_[OscPacket::capacity];
+        };
+
+        const uint32 mask_;
+        std::unique_ptr<Slot[]> slots_;
+        std::atomic<uint32> enqueuePos_ { 0 };
+        uint32 dequeuePos_ = 0;     // sender thread only
+
+        JUCE_DECLARE_NON_COPYABLE(Ring)
+    };
+
+    void wake()
+    {
+        if (wakeFd_ >= 0)
+        {
+            uint64 one = 1;
+            ssize_t ignored = ::write(wakeFd_, &one, sizeof(one));
+            (void) ignored;
+        }
+    }
+
+    void run() override
+    {
+        pollfd fd = { wakeFd_, POLLIN, 0 };
+        while (!threadShouldExit())
+        {
+            if (poll(&fd, 1, -1) > 0)
+            {
+                uint64 value;
+                ssize_t ignored = ::read(wakeFd_, &value, sizeof(value));
+                (void) ignored;
+            }
+
+            // the whole engine lane, then one mirror packet at a time in
+            // between whatever the engine lane got meanwhile
+            do
+            {
+                while (lanes_[EngineLane].sendNext())
+                {
+                }
+            } while (lanes_[MirrorLane].sendNext());
+        }
+
+        while (lanes_[EngineLane].sendNext())
+        {
+        }
+    }
+
+    Ring lanes_[NumLanes];
+    const int wakeFd_;     // open as long as the queue, post() may wake it from any thread
+    std::atomic<int64> drops_ { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(OscSendQueue)
+};
@@ -0,0 +1,212 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LooperCore.h"
+#include <limits>
+
+// Per pedal thresholds in ms, 0 turns that part off
+struct PedalGestureConfig
+{
+    double debounceMs_ = 0.0;   // edges this soon after the last one are chatter
+    double longPressMs_ = 0.0;  // held this long is a long press
+    double doubleTapMs_ = 0.0;  // pressed again this soon is a double tap
+};
+
+/*
+ ==============================================================================
+ Turns the raw pedal edges into presses, releases, long presses and double
+ taps, without holding any of them back.
+
+ Every press goes through on its down edge, as it would without gestures.
+ A long press or double tap is reported on top of it once it has happened:
+ when the hold time passes with the pedal still down, or on the second down
+ edge. A single press never waits to see whether a gesture follows, the
+ gesture's action follows up on whatever the press started.
+
+ An edge within debounceMs of the last one a pedal delivered is chatter from
+ a worn switch and is dropped. If the pedal ended up on the other side when
+ that window closes, the missing edge is delivered then.
+
+ Each pedal has at most a hold and a settle deadline; nextDeadline() says
+ when expire() has something to do next. Not thread safe, whoever drives the
+ core drives this too.
+ ==============================================================================
+ */
+class PedalGestures
+{
+public:
+    static const int maxPedals = DOWN + 1;
+
+    struct Listener
+    {
+        virtual ~Listener() {}
+        virtual void pedalEdge(int pedalIdx, bool down, double timeMs) = 0;
+        virtual void pedalLongPress(int pedalIdx, double timeMs) = 0;
+        virtual void pedalDoubleTap(int pedalIdx, double timeMs) = 0;
+    };
+
+    PedalGestures(Listener& listener) : listener_(listener) {}
+
+    void setConfig(int pedalIdx, const PedalGestureConfig& config)
+    {
+        if (isPositiveAndBelow(pedalIdx, maxPedals))
+        {
+            pedals_[pedalIdx].config_ = config;
+        }
+    }
+
+    PedalGestureConfig getConfig(int pedalIdx) const
+    {
+        return isPositiveAndBelow(pedalIdx, maxPedals) ? pedals_[pedalIdx].config_ : PedalGestureConfig();
+    }
+
+    void edge(int pedalIdx, bool down, double timeMs)
+    {
+        if (!isPositiveAndBelow(pedalIdx, maxPedals))
+        {
+            listener_.pedalEdge(pedalIdx, down, timeMs);
+            return;
+        }
+
+        // whatever came due before this edge happened first
+        expire(pedalIdx, timeMs);
+
+        Pedal& pedal = pedals_[pedalIdx];
+        pedal.raw_ = down;
+        if (pedal.config_.debounceMs_ > 0.0 && timeMs - pedal.lastEdgeAt_ < pedal.config_.debounceMs_)
+        {
+            chatter_++;
+            pedal.settleAt_ = pedal.lastEdgeAt_ + pedal.config_.debounceMs_;
+            return;
+        }
+        deliver(pedalIdx, down, timeMs);
+    }
+
+    // reports everything that came due up to nowMs
+    void expire(double nowMs)
+    {
+        for (int i = 0; i < maxPedals; i++)
+        {
+            expire(i, nowMs);
+        }
+    }
+
+    // when expire() next has something to do, 0 if nothing is pending
+    double nextDeadline() const
+    {
+        double next = 0.0;
+        for (const Pedal& pedal : pedals_)
+        {
+            double due = pedal.deadline();
+            if (due > 0.0 && (next == 0.0 || due < next))
+            {
+                next = due;
+            }
+        }
+        return next;
+    }
+
+    int64 getChatterCount() const
+    {
+        return chatter_;
+    }
+
+private:
+    struct Pedal
+    {
+        PedalGestureConfig config_;
+        bool down_ = false;         // as last delivered
+        bool raw_ = false;          // as last seen, chatter included
+        double lastEdgeAt_ = std::numeric_limits<double>::lowest();
+        double lastPressAt_ = std::numeric_limits<double>::lowest();
+        double holdAt_ = 0.0;       // a long press, 0 if none is pending
+        double settleAt_ = 0.0;     // the end of a debounce window with chatter in it
+
+        double deadline() const
+        {
+            if (holdAt_ == 0.0 || (settleAt_ != 0.0 && settleAt_ < holdAt_))
+            {
+                return settleAt_;
+            }
+            return holdAt_;
+        }
+    };
+
+    void deliver(int pedalIdx, bool down, double timeMs)
+    {
+        Pedal& pedal = pedals_[pedalIdx];
+        pedal.down_ = down;
+        pedal.lastEdgeAt_ = timeMs;
+        pedal.settleAt_ = 0.0;
+        pedal.holdAt_ = 0.0;
+
+        listener_.pedalEdge(pedalIdx, down, timeMs);
+        if (!down)
+        {
+            return;
+        }
+
+        if (pedal.config_.longPressMs_ > 0.0)
+        {
+            pedal.holdAt_ = timeMs + pedal.config_.longPressMs_;
+        }
+
+        if (pedal.config_.doubleTapMs_ > 0.0 && timeMs - pedal.lastPressAt_ <= pedal.config_.doubleTapMs_)
+        {
+            pedal.lastPressAt_ = std::numeric_limits<double>::lowest();
+            listener_.pedalDoubleTap(pedalIdx, timeMs);
+        }
+        else
+        {
+            pedal.lastPressAt_ = timeMs;
+        }
+    }
+
+    void expire(int pedalIdx, double nowMs)
+    {
+        Pedal& pedal = pedals_[pedalIdx];
+        for (double due = pedal.deadline(); due > 0.0 && due <= nowMs; due = pedal.deadline())
+        {
+            if (due == pedal.settleAt_)
+            {
+                pedal.settleAt_ = 0.0;
+                if (pedal.raw_ != pedal.down_)
+                {
+                    deliver(pedalIdx, pedal.raw_, due);
+                }
+            }
+            else
+            {
+                // a held pedal doesn't start a double tap
+                pedal.holdAt_ = 0.0;
+                pedal.lastPressAt_ = std::numeric_limits<double>::lowest();
+                listener_.pedalLongPress(pedalIdx, due);
+            }
+        }
+    }
+
+    Listener& listener_;
+    Pedal pedals_[maxPedals];
+    int64 chatter_ = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(PedalGestures)
+};
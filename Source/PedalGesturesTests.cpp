@@ -0,0 +1,141 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "PedalGestures.h"
+
+#if JUCE_UNIT_TESTS
+
+// PedalGestures is all in its header, its tests are here
+class PedalGesturesTests : public UnitTest, private PedalGestures::Listener
+{
+public:
+    PedalGesturesTests() : UnitTest("PedalGestures", "loop4r") {}
+
+    void runTest() override
+    {
+        beginTest("Chatter inside the debounce window is dropped");
+        {
+            PedalGestures gestures(*this);
+            events_.clear();
+            gestures.setConfig(TRACK1, { 15.0, 0.0, 0.0 });
+
+            gestures.edge(TRACK1, true, 100.0);
+            gestures.edge(TRACK1, false, 105.0);
+            gestures.edge(TRACK1, true, 110.0);
+            gestures.expire(200.0);
+            gestures.edge(TRACK1, false, 200.0);
+
+            expectEvents({ "down 0 @100", "up 0 @200" });
+            expectEquals(gestures.getChatterCount(), (int64) 2);
+        }
+
+        beginTest("The missing edge is delivered when the window closes");
+        {
+            PedalGestures gestures(*this);
+            events_.clear();
+            gestures.setConfig(TRACK1, { 15.0, 0.0, 0.0 });
+
+            gestures.edge(TRACK1, true, 100.0);
+            gestures.edge(TRACK1, false, 108.0);
+            expectEquals(gestures.nextDeadline(), 115.0);
+            gestures.expire(114.0);
+            expectEvents({ "down 0 @100" });
+
+            gestures.expire(115.0);
+            expectEvents({ "down 0 @100", "up 0 @115" });
+            expectEquals(gestures.nextDeadline(), 0.0);
+        }
+
+        beginTest("A hold fires once and doesn't start a double tap");
+        {
+            PedalGestures gestures(*this);
+            events_.clear();
+            gestures.setConfig(UNDO, { 0.0, 800.0, 1000.0 });
+
+            gestures.edge(UNDO, true, 0.0);
+            expectEquals(gestures.nextDeadline(), 800.0);
+            gestures.expire(799.0);
+            gestures.expire(800.0);
+            gestures.expire(2000.0);
+            expectEvents({ "down 9 @0", "long 9 @800" });
+
+            gestures.edge(UNDO, false, 850.0);
+            gestures.edge(UNDO, true, 900.0);
+            gestures.edge(UNDO, false, 950.0);
+            gestures.expire(3000.0);
+            expectEvents({ "down 9 @0", "long 9 @800", "up 9 @850", "down 9 @900", "up 9 @950" });
+        }
+
+        beginTest("A second press within the window is a double tap");
+        {
+            PedalGestures gestures(*this);
+            events_.clear();
+            gestures.setConfig(UNDO, { 0.0, 800.0, 300.0 });
+
+            gestures.edge(UNDO, true, 0.0);
+            gestures.edge(UNDO, false, 50.0);
+            gestures.edge(UNDO, true, 200.0);
+            gestures.edge(UNDO, false, 250.0);
+            gestures.edge(UNDO, true, 400.0);   // a third press starts over
+            gestures.edge(UNDO, false, 450.0);
+            expectEvents({ "down 9 @0", "up 9 @50", "down 9 @200", "tap 9 @200", "up 9 @250", "down 9 @400", "up 9 @450" });
+        }
+
+        beginTest("A single press is never delayed");
+        {
+            PedalGestures gestures(*this);
+            events_.clear();
+            gestures.setConfig(TRACK2, { 15.0, 800.0, 300.0 });
+
+            gestures.edge(TRACK2, true, 100.0);
+            expectEvents({ "down 1 @100" });
+            gestures.edge(TRACK2, false, 150.0);
+            expectEvents({ "down 1 @100", "up 1 @150" });
+            gestures.expire(10000.0);
+            expectEvents({ "down 1 @100", "up 1 @150" });
+        }
+    }
+
+private:
+    void pedalEdge(int pedalIdx, bool down, double timeMs) override
+    {
+        events_.add(String(down ? "down " : "up ") + String(pedalIdx) + " @" + String(timeMs));
+    }
+
+    void pedalLongPress(int pedalIdx, double timeMs) override
+    {
+        events_.add("long " + String(pedalIdx) + " @" + String(timeMs));
+    }
+
+    void pedalDoubleTap(int pedalIdx, double timeMs) override
+    {
+        events_.add("tap " + String(pedalIdx) + " @" + String(timeMs));
+    }
+
+    void expectEvents(const StringArray& expected)
+    {
+        expect(events_ == expected, "got " + events_.joinIntoString(", "));
+    }
+
+    StringArray events_;
+};
+
+static PedalGesturesTests pedalGesturesTests;
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <alsa/asoundlib.h>
+#include <atomic>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*
+ ==============================================================================
+ A non-blocking ALSA rawmidi output fed from a bounded byte queue.
+
+ write() only copies the message into the queue and never blocks; when the
+ queue can't take the whole message it is dropped and counted. A writer
+ thread moves the queue to the port whenever its descriptors are writable,
+ so the DIN link's 3125 bytes/s never hold up the caller.
+ ==============================================================================
+ */
+class RawMidiOutput : private Thread
+{
+public:
+    // Optional pull side of the queue: the writer asks it for more bytes
+    // whenever the queue runs low. Called on the writer thread.
+    struct Source
+    {
+        virtual ~Source() {}
+        // copies up to maxBytes of whole messages to dest, returns the count
+        virtual int pull(char* dest, int maxBytes, uint32 nowMs) = 0;
+        // how long until pull() could return something, in ms
+        virtual int msUntilReady(uint32 nowMs) = 0;
+    };
+
+    RawMidiOutput(int capacity = 1024)
+    : Thread("rawmidi out"), wakeFd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), fifo_(capacity)
+    {
+        buffer_.malloc((size_t) capacity);
+    }
+
+    ~RawMidiOutput()
+    {
+        close();
+        if (wakeFd_ >= 0)
+        {
+            ::close(wakeFd_);
+        }
+    }
+
+    // returns 0 or a negative ALSA error code
+    int open(const String& name)
+    {
+        close();
+
+        int err = snd_rawmidi_open(NULL, &handle_, name.toRawUTF8(), SND_RAWMIDI_NONBLOCK);
+        if (err < 0)
+        {
+            handle_ = nullptr;
+            return err;
+        }
+
+        fifo_.reset();
+        startThread(8);
+        return 0;
+    }
+
+    void close()
+    {
+        if (handle_ == nullptr)
+        {
+            return;
+        }
+
+        signalThreadShouldExit();
+        wake();
+        stopThread(1000);
+
+        snd_rawmidi_close(handle_);
+        handle_ = nullptr;
+    }
+
+    bool isOpen() const
+    {
+        return handle_ != nullptr;
+    }
+
+    void setSource(Source* source)
+    {
+        source_ = source;
+    }
+
+    // wakes the writer, e.g. after the source got new messages
+    void wake()
+    {
+        if (wakeFd_ >= 0)
+        {
+            uint64 one = 1;
+            ssize_t ignored = ::write(wakeFd_, &one, sizeof(one));
+            (void) ignored;
+        }
+    }
+
+    // Queues a complete message, returns false if it had to be dropped.
+    // Safe to call from any thread.
+    bool write(const void* data, int size)
+    {
+        {
+            const SpinLock::ScopedLockType sl(writeLock_);
+            if (fifo_.getFreeSpace() < size)
+            {
+                drops_++;
+                return false;
+            }
+
+            push(static_cast<const char*>(data), size);
+        }
+
+        wake();
+        return true;
+    }
+
+    // bytes waiting to be written
+    int getFillLevel() const
+    {
+        return fifo_.getNumReady();
+    }
+
+    int getCapacity() const
+    {
+        return fifo_.getTotalSize() - 1;
+    }
+
+    int64 getDropCount() const
+    {
+        return drops_;
+    }
+
+    int64 getBytesWritten() const
+    {
+        return bytesWritten_;
+    }
+
+private:
+    // keeps only a few messages in the queue so the source can still reorder the rest
+    static const int sourceLowWater = 12;
+
+    void run() override
+    {
+        int count = jmax(0, snd_rawmidi_poll_descriptors_count(handle_));
+        HeapBlock<pollfd> fds((size_t) count + 1);
+        fds[0] = { wakeFd_, POLLIN, 0 };
+        snd_rawmidi_poll_descriptors(handle_, fds + 1, (unsigned int) count);
+
+        while (!threadShouldExit())
+        {
+            int timeout = 100;
+            if (Source* source = source_)
+            {
+                uint32 now = Time::getMillisecondCounter();
+                refillFromSource(*source, now);
+                timeout = jlimit(1, 100, source->msUntilReady(now));
+            }
+
+            // only ask for POLLOUT while there's something to write
+            bool pending = fifo_.getNumReady() > 0;
+            for (auto i = 1; i <= count; i++)
+            {
+                fds[i].events = pending ? POLLOUT : 0;
+                fds[i].revents = 0;
+            }
+
+            if (poll(fds, (nfds_t) count + 1, timeout) <= 0)
+            {
+                continue;
+            }
+
+            if (fds[0].revents & POLLIN)
+            {
+                uint64 value;
+                ssize_t ignored = ::read(wakeFd_, &value, sizeof(value));
+                (void) ignored;
+            }
+
+            if (pending)
+            {
+                unsigned short revents = 0;
+                snd_rawmidi_poll_descriptors_revents(handle_, fds + 1, (unsigned int) count, &revents);
+                if (revents & POLLOUT)
+                {
+                    flush();
+                }
+            }
+        }
+    }
+
+    // called with writeLock_ held
+    void push(const char* data, int size)
+    {
+        int start1, size1, start2, size2;
+        fifo_.prepareToWrite(size, start1, size1, start2, size2);
+        memcpy(buffer_ + start1, data, (size_t) size1);
+        memcpy(buffer_ + start2, data + size1, (size_t) size2);
+        fifo_.finishedWrite(size1 + size2);
+    }
+
+    void refillFromSource(Source& source, uint32 now)
+    {
+        const SpinLock::ScopedLockType sl(writeLock_);
+        int room = jmin(sourceLowWater - fifo_.getNumReady(), fifo_.getFreeSpace());
+        if (room <= 0)
+        {
+            return;
+        }
+
+        char chunk[sourceLowWater];
+        int size = source.pull(chunk, room, now);
+        if (size > 0)
+        {
+            push(chunk, size);
+        }
+    }
+
+    // writes as much of the queue as the port takes without blocking
+    void flush()
+    {
+        int start1, size1, start2, size2;
+        fifo_.prepareToRead(fifo_.getNumReady(), start1, size1, start2, size2);
+
+        int written = writeSome(buffer_ + start1, size1);
+        if (written == size1 && size2 > 0)
+        {
+            written += writeSome(buffer_ + start2, size2);
+        }
+        fifo_.finishedRead(written);
+    }
+
+    int writeSome(const char* data, int size)
+    {
+        ssize_t n = snd_rawmidi_write(handle_, data, (size_t) size);
+        if (n < 0)
+        {
+            if (n != -EAGAIN)
+            {
+                // discard what the port refused rather than retrying it forever
+                std::cerr << "rawmidi write failed: " << snd_strerror((int) n) << std::endl;
+                return size;
+            }
+            return 0;
+        }
+        bytesWritten_.fetch_add(n, std::memory_order_relaxed);
+        return (int) n;
+    }
+
+    snd_rawmidi_t* handle_ = nullptr;
+    std::atomic<Source*> source_ { nullptr };
+    const int wakeFd_;     // open as long as the output, wake() may be called from any thread
+    AbstractFifo fifo_;
+    HeapBlock<char> buffer_;
+    SpinLock writeLock_;  // write() may be called from the message and MIDI threads
+    std::atomic<int64> drops_ { 0 };
+    std::atomic<int64> bytesWritten_ { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(RawMidiOutput)
+};
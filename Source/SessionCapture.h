@@ -0,0 +1,479 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/*
+ ==============================================================================
+ Session capture file format
+
+ An 8 byte header "L4RCAP" 0 1 followed by append-only records:
+
+    uint8   kind        (CaptureKind)
+    varint  delta       microseconds since the previous record (monotonic clock)
+    varint  size        payload size in bytes
+    uint8[] payload     raw MIDI bytes, OSC datagram or rawmidi bytes
+
+ Varints are unsigned LEB128, so a typical pedal or LED record is 6 bytes.
+ ==============================================================================
+ */
+enum CaptureKind
+{
+    CaptureMidiIn = 1,  // pedal MIDI from the FCB1010
+    CaptureOscIn = 2,   // datagram received on the OSC port
+    CaptureOscOut = 3,  // datagram sent to the engine or the LED mirror
+    CaptureLedOut = 4,  // bytes written to the FCB1010 rawmidi port
+    NumCaptureKinds = 4
+};
+
+static const char captureMagic[8] = { 'L', '4', 'R', 'C', 'A', 'P', 0, 1 };
+
+static inline int64 monotonicMicroseconds()
+{
+    return (int64) (Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks()) * 1.0e6);
+}
+
+//==============================================================================
+/*
+ Appends timestamped records to a capture file. record() may be called from
+ any thread and only copies the record into a bounded queue, dropping it when
+ the queue is full; flush() writes the queue to the disk, e.g. from a timer.
+
+ Each kind of record has a queue of its own, since each comes from one
+ thread: pedals from the MIDI thread, datagrams from the OSC receiver and
+ sender threads, LED bytes from the controller. flush() merges them by
+ timestamp, leaving the last few ms queued in case a record stamped before
+ them is still being copied in.
+ */
+class SessionCapture
+{
+public:
+    SessionCapture(int laneCapacity = 128 * 1024)
+    {
+        for (auto&& lane : lanes_)
+        {
+            lane.allocate(laneCapacity);
+        }
+    }
+
+    ~SessionCapture()
+    {
+        stop();
+    }
+
+    bool start(const File& file)
+    {
+        stop();
+
+        const ScopedLock sl(streamLock_);
+        file.deleteFile();
+        stream_.reset(new FileOutputStream(file, 64 * 1024));
+        if (stream_->failedToOpen())
+        {
+            stream_.reset();
+            return false;
+        }
+
+        file_ = file;
+        stream_->write(captureMagic, sizeof(captureMagic));
+        startTime_ = lastTime_ = monotonicMicroseconds();
+        pedalEvents_.clear();
+        records_ = 0;
+        for (auto&& lane : lanes_)
+        {
+            lane.reset();
+        }
+        active_ = true;
+        return true;
+    }
+
+    void stop()
+    {
+        const ScopedLock sl(streamLock_);
+        if (stream_ == nullptr)
+        {
+            return;
+        }
+
+        active_ = false;
+        writeQueue(std::numeric_limits<int64>::max());
+        stream_->flush();
+        stream_.reset();
+        exportPedalEvents();
+        std::cerr << "Captured " << records_ << " records to " << file_.getFullPathName();
+        if (drops_ > 0)
+        {
+            std::cerr << ", " << drops_ << " dropped on a full queue";
+        }
+        std::cerr << std::endl;
+    }
+
+    bool isActive() const
+    {
+        return active_;
+    }
+
+    // Queues a record, stamped now. Never blocks on the disk.
+    void record(CaptureKind kind, const void* data, int size)
+    {
+        if (!active_ || !isPositiveAndBelow(kind - 1, (int) NumCaptureKinds))
+        {
+            return;
+        }
+
+        if (!lanes_[kind - 1].push(kind, data, size))
+        {
+            drops_++;
+        }
+    }
+
+    // writes the queued records to the file
+    void flush()
+    {
+        const ScopedLock sl(streamLock_);
+        if (stream_ != nullptr)
+        {
+            writeQueue(monotonicMicroseconds() - settleMicroseconds);
+            stream_->flush();
+        }
+    }
+
+    int64 getDropCount() const
+    {
+        return drops_;
+    }
+
+private:
+    // how long a record may take from its timestamp to its queue
+    static const int64 settleMicroseconds = 10000;
+
+    struct RecordHeader
+    {
+        int64 time_;
+        int32 size_;
+        uint8 kind_;
+    };
+
+    // One kind's records, a single producer queue. The lock only matters when
+    // a second thread records the same kind, e.g. a replay's pedals; it also
+    // keeps the stamps in queue order.
+    class Lane
+    {
+    public:
+        Lane() : fifo_(1) {}
+
+        void allocate(int capacity)
+        {
+            fifo_.setTotalSize(capacity);
+            buffer_.malloc((size_t) capacity);
+        }
+
+        void reset()
+        {
+            const SpinLock::ScopedLockType sl(writeLock_);
+            fifo_.reset();
+        }
+
+        bool push(CaptureKind kind, const void* data, int size)
+        {
+            int total = (int) sizeof(RecordHeader) + size;
+
+            const SpinLock::ScopedLockType sl(writeLock_);
+            if (fifo_.getFreeSpace() < total)
+            {
+                return false;
+            }
+
+            RecordHeader header = { monotonicMicroseconds(), size, (uint8) kind };
+            int start1, size1, start2, size2;
+            fifo_.prepareToWrite(total, start1, size1, start2, size2);
+            copyIn(0, &header, (int) sizeof(header), start1, size1, start2);
+            copyIn((int) sizeof(header), data, size, start1, size1, start2);
+            fifo_.finishedWrite(total);
+            return true;
+        }
+
+        // the oldest record's header, false if there is none
+        bool peek(RecordHeader& header) const
+        {
+            if (fifo_.getNumReady() < (int) sizeof(header))
+            {
+                return false;
+            }
+            int start1, size1, start2, size2;
+            fifo_.prepareToRead((int) sizeof(header), start1, size1, start2, size2);
+            copyOut(0, &header, (int) sizeof(header), start1, size1, start2);
+            return true;
+        }
+
+        // takes the oldest record, whose header peek() returned, into payload
+        void pop(const RecordHeader& header, MemoryBlock& payload)
+        {
+            int total = (int) sizeof(header) + header.size_;
+            int start1, size1, start2, size2;
+            fifo_.prepareToRead(total, start1, size1, start2, size2);
+            payload.ensureSize((size_t) header.size_);
+            copyOut((int) sizeof(header), payload.getData(), header.size_, start1, size1, start2);
+            fifo_.finishedRead(total);
+        }
+
+    private:
+        // copies to and from the fifo regions of a prepared write or read, at
+        // offset bytes into them
+        void copyIn(int offset, const void* data, int size, int start1, int size1, int start2)
+        {
+            auto* src = static_cast<const char*>(data);
+            int first = jlimit(0, size, size1 - offset);
+            if (first > 0)
+            {
+                memcpy(buffer_ + start1 + offset, src, (size_t) first);
+            }
+            if (size > first)
+            {
+                memcpy(buffer_ + start2 + jmax(0, offset - size1), src + first, (size_t) (size - first));
+            }
+        }
+
+        void copyOut(int offset, void* data, int size, int start1, int size1, int start2) const
+        {
+            auto* dest = static_cast<char*>(data);
+            int first = jlimit(0, size, size1 - offset);
+            if (first > 0)
+            {
+                memcpy(dest, buffer_ + start1 + offset, (size_t) first);
+            }
+            if (size > first)
+            {
+                memcpy(dest + first, buffer_ + start2 + jmax(0, offset - size1), (size_t) (size - first));
+            }
+        }
+
+        AbstractFifo fifo_;
+        HeapBlock<char> buffer_;
+        SpinLock writeLock_;
+
+        JUCE_DECLARE_NON_COPYABLE(Lane)
+    };
+
+    // Writes the queued records stamped up to cutoff, oldest first across the
+    // lanes. Called with streamLock_ held, on the one thread that reads them.
+    void writeQueue(int64 cutoff)
+    {
+        for (;;)
+        {
+            RecordHeader header, oldest;
+            int next = -1;
+            for (auto i = 0; i < NumCaptureKinds; i++)
+            {
+                if (lanes_[i].peek(header) && header.time_ <= cutoff && (next < 0 || header.time_ < oldest.time_))
+                {
+                    oldest = header;
+                    next = i;
+                }
+            }
+            if (next < 0)
+            {
+                return;
+            }
+
+            lanes_[next].pop(oldest, payload_);
+            stream_->writeByte((char) oldest.kind_);
+            writeVarint((uint64) jmax((int64) 0, oldest.time_ - lastTime_));
+            writeVarint((uint64) oldest.size_);
+            stream_->write(payload_.getData(), (size_t) oldest.size_);
+            lastTime_ = oldest.time_;
+            records_++;
+
+            if (oldest.kind_ == CaptureMidiIn && oldest.size_ > 0)
+            {
+                pedalEvents_.addEvent(MidiMessage(payload_.getData(), oldest.size_, (oldest.time_ - startTime_) * 1.0e-3));
+            }
+        }
+    }
+
+    void writeVarint(uint64 value)
+    {
+        do
+        {
+            uint8 byte = value & 0x7f;
+            value >>= 7;
+            stream_->writeByte((char) (value != 0 ? byte | 0x80 : byte));
+        } while (value != 0);
+    }
+
+    // Writes the pedal events next to the capture as a standard MIDI file,
+    // using SMPTE timing at 1 tick per millisecond.
+    void exportPedalEvents()
+    {
+        if (pedalEvents_.getNumEvents() == 0)
+        {
+            return;
+        }
+
+        MidiFile midiFile;
+        midiFile.setSmpteTimeFormat(25, 40);
+        midiFile.addTrack(pedalEvents_);
+
+        FileOutputStream out(file_.withFileExtension("mid"));
+        if (out.openedOk())
+        {
+            out.setPosition(0);
+            out.truncate();
+            midiFile.writeTo(out);
+        }
+    }
+
+    CriticalSection streamLock_;    // start, stop and flush
+    std::atomic<bool> active_ { false };
+    Lane lanes_[NumCaptureKinds];   // by kind - 1
+    MemoryBlock payload_;
+    std::atomic<int64> drops_ { 0 };
+    std::unique_ptr<FileOutputStream> stream_;
+    File file_;
+    int64 startTime_ = 0;
+    int64 lastTime_ = 0;
+    int64 records_ = 0;
+    MidiMessageSequence pedalEvents_; // timestamps in ms
+
+    JUCE_DECLARE_NON_COPYABLE(SessionCapture)
+};
+
+//==============================================================================
+/*
+ Plays a capture file back on its own thread, either at the recorded pace
+ (scaled by speed) or as fast as possible when speed is 0. Only the inbound
+ records are replayed; the outbound ones are what the controller regenerates.
+ */
+class SessionReplay : private Thread
+{
+public:
+    std::function<void (const MidiMessage&)> onMidiIn;
+    std::function<void (const void* data, int size)> onOscIn;
+    std::function<void ()> onFinished;
+
+    SessionReplay() : Thread("loop4r replay") {}
+
+    ~SessionReplay()
+    {
+        stopThread(2000);
+    }
+
+    bool start(const File& file, double speed)
+    {
+        stopThread(2000);
+
+        data_.reset();
+        if (!file.loadFileAsData(data_) || data_.getSize() < sizeof(captureMagic)
+            || memcmp(data_.getData(), captureMagic, sizeof(captureMagic)) != 0)
+        {
+            std::cerr << "Not a loop4r capture file: " << file.getFullPathName() << std::endl;
+            return false;
+        }
+
+        speed_ = speed;
+        startThread(8);
+        return true;
+    }
+
+    bool isReplaying() const
+    {
+        return isThreadRunning();
+    }
+
+private:
+    void run() override
+    {
+        auto* data = static_cast<const uint8*>(data_.getData());
+        size_t size = data_.getSize();
+        size_t pos = sizeof(captureMagic);
+
+        int64 start = monotonicMicroseconds();
+        int64 due = 0;
+        int64 records = 0;
+
+        while (pos < size && !threadShouldExit())
+        {
+            uint8 kind = data[pos++];
+            uint64 delta, length;
+            if (!readVarint(data, size, pos, delta) || !readVarint(data, size, pos, length) || pos + length > size)
+            {
+                std::cerr << "Truncated capture record at offset " << (int64) pos << std::endl;
+                break;
+            }
+
+            const uint8* payload = data + pos;
+            pos += (size_t) length;
+            due += (int64) delta;
+
+            // a MidiMessage needs at least one byte
+            if ((kind != CaptureMidiIn && kind != CaptureOscIn) || (kind == CaptureMidiIn && length == 0))
+            {
+                continue;
+            }
+
+            if (speed_ > 0)
+            {
+                int64 wait = start + (int64) (due / speed_) - monotonicMicroseconds();
+                if (wait > 1000)
+                {
+                    Thread::wait((int) (wait / 1000));
+                }
+            }
+
+            if (kind == CaptureMidiIn && onMidiIn != nullptr)
+            {
+                onMidiIn(MidiMessage(payload, (int) length, 0.0));
+            }
+            else if (kind == CaptureOscIn && onOscIn != nullptr)
+            {
+                onOscIn(payload, (int) length);
+            }
+            records++;
+        }
+
+        std::cerr << "Replayed " << records << " records in "
+                  << (monotonicMicroseconds() - start) / 1000 << " ms" << std::endl;
+
+        if (onFinished != nullptr)
+        {
+            onFinished();
+        }
+    }
+
+    static bool readVarint(const uint8* data, size_t size, size_t& pos, uint64& value)
+    {
+        value = 0;
+        for (int shift = 0; pos < size && shift < 64; shift += 7)
+        {
+            uint8 byte = data[pos++];
+            value |= (uint64) (byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    MemoryBlock data_;
+    double speed_ = 1.0;
+
+    JUCE_DECLARE_NON_COPYABLE(SessionReplay)
+};
@@ -0,0 +1,138 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LooperCore.h"
+#include <atomic>
+
+/*
+ ==============================================================================
+ Keeps the core's state in a memory mapped file, so a restarted controller
+ can show the LEDs it had right away instead of after the engine handshake.
+
+ Saving is a copy into the mapping, the kernel writes the pages back in its
+ own time, and that survives the process crashing. There are two slots:
+ a save fills the one not in use and then flips to it, so a crash in the
+ middle of a save still leaves the previous state intact.
+ ==============================================================================
+ */
+class StateSnapshot
+{
+public:
+    StateSnapshot() {}
+
+    ~StateSnapshot()
+    {
+        close();
+    }
+
+    // maps file, creating it if needed, returns false if it can't be mapped
+    bool open(const File& file)
+    {
+        close();
+
+        if (file.getSize() != (int64) sizeof(Layout))
+        {
+            Layout empty;
+            zerostruct(empty);
+            if (!file.replaceWithData(&empty, sizeof(empty)))
+            {
+                return false;
+            }
+        }
+
+        mapping_.reset(new MemoryMappedFile(file, MemoryMappedFile::readWrite));
+        if (mapping_->getData() == nullptr || mapping_->getSize() != sizeof(Layout))
+        {
+            mapping_ = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        mapping_ = nullptr;
+    }
+
+    bool isOpen() const
+    {
+        return mapping_ != nullptr;
+    }
+
+    // the last saved state, false if there is none
+    bool load(LooperSnapshot& state) const
+    {
+        const Layout* layout = getLayout();
+        if (layout == nullptr || layout->magic_ != magic || layout->version_ != version || layout->current_ > 1)
+        {
+            return false;
+        }
+
+        state = layout->slots_[layout->current_];
+        return true;
+    }
+
+    // saves the core's state, if it changed since the last save
+    void save(const LooperCore& core)
+    {
+        Layout* layout = getLayout();
+        if (layout == nullptr)
+        {
+            return;
+        }
+
+        core.saveState(scratch_);
+        bool valid = layout->magic_ == magic && layout->version_ == version && layout->current_ <= 1;
+        if (valid && memcmp(&scratch_, &layout->slots_[layout->current_], sizeof(scratch_)) == 0)
+        {
+            return;
+        }
+
+        uint32 next = valid ? 1 - layout->current_ : 0;
+        layout->slots_[next] = scratch_;
+        std::atomic_thread_fence(std::memory_order_release);
+        layout->current_ = next;
+        layout->magic_ = magic;
+        layout->version_ = version;
+    }
+
+private:
+    static const uint32 magic = 0x6c347273;    // "l4rs"
+    static const uint32 version = 1;
+
+    struct Layout
+    {
+        uint32 magic_;
+        uint32 version_;
+        uint32 current_;                // the slot holding the latest state
+        LooperSnapshot slots_[2];
+    };
+
+    Layout* getLayout() const
+    {
+        return mapping_ != nullptr ? static_cast<Layout*>(mapping_->getData()) : nullptr;
+    }
+
+    std::unique_ptr<MemoryMappedFile> mapping_;
+    LooperSnapshot scratch_;
+
+    JUCE_DECLARE_NON_COPYABLE(StateSnapshot)
+};
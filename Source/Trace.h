@@ -0,0 +1,169 @@
+/*
+ * This file is part of loop4r_control.
+ * Copyright (C) 2018 Atin Malaviya.  https://www.github.com/atinm
+ *
+ * loop4r_control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * loop4r_control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ ==============================================================================
+ Trace spans for profiling, compiled in with -DLOOP4R_TRACE=1 (e.g.
+ make CPPFLAGS=-DLOOP4R_TRACE=1). Otherwise LOOP4R_TRACE_SCOPE expands to
+ nothing and this header declares nothing else.
+
+ Each thread writes begin/end records into its own ring buffer, so tracing
+ takes no locks; the oldest records are overwritten when a ring is full.
+ loop4rTrace::dump() writes all rings as Chrome trace-event JSON, which
+ Perfetto and chrome://tracing open directly.
+
+ AppConfig.h includes this file, so that JUCE's OSC classes can use the
+ same spans, which is why it only depends on the standard library.
+ ==============================================================================
+ */
+
+#ifndef LOOP4R_TRACE
+ #define LOOP4R_TRACE 0
+#endif
+
+#if LOOP4R_TRACE
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace loop4rTrace
+{
+    struct Record
+    {
+        const char* name_;  // a string literal
+        uint64_t ns_;
+        char phase_;        // 'B'egin or 'E'nd
+    };
+
+    struct ThreadRing
+    {
+        static const uint32_t size = 16384;
+
+        long tid_;
+        char threadName_[16];
+        std::atomic<uint32_t> written_ { 0 };
+        Record records_[size];
+    };
+
+    struct Registry
+    {
+        std::mutex mutex_;
+        std::vector<ThreadRing*> rings_;
+    };
+
+    // one registry for all translation units, rings are never freed so a
+    // dump still sees threads that have finished
+    inline Registry& registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    inline ThreadRing& threadRing()
+    {
+        thread_local ThreadRing* ring = nullptr;
+        if (ring == nullptr)
+        {
+            ring = new ThreadRing();
+            ring->tid_ = (long) syscall(SYS_gettid);
+            pthread_getname_np(pthread_self(), ring->threadName_, sizeof(ring->threadName_));
+
+            Registry& all = registry();
+            std::lock_guard<std::mutex> guard(all.mutex_);
+            all.rings_.push_back(ring);
+        }
+        return *ring;
+    }
+
+    inline uint64_t now()
+    {
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t) t.tv_sec * 1000000000u + (uint64_t) t.tv_nsec;
+    }
+
+    inline void record(const char* name, char phase)
+    {
+        ThreadRing& ring = threadRing();
+        uint32_t index = ring.written_.load(std::memory_order_relaxed);
+        ring.records_[index % ThreadRing::size] = { name, now(), phase };
+        ring.written_.store(index + 1, std::memory_order_release);
+    }
+
+    struct Scope
+    {
+        explicit Scope(const char* name) : name_(name) { record(name_, 'B'); }
+        ~Scope() { record(name_, 'E'); }
+
+        const char* name_;
+    };
+
+    // Writes every ring as Chrome trace-event JSON, returns false if the
+    // file can't be written. Records written during the dump may be torn.
+    inline bool dump(const char* path)
+    {
+        FILE* file = fopen(path, "w");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        Registry& all = registry();
+        std::lock_guard<std::mutex> guard(all.mutex_);
+
+        long pid = (long) getpid();
+        const char* separator = "";
+        fprintf(file, "{\"traceEvents\":[\n");
+        for (ThreadRing* ring : all.rings_)
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                    separator, pid, ring->tid_, ring->threadName_);
+            separator = ",\n";
+
+            uint32_t end = ring->written_.load(std::memory_order_acquire);
+            uint32_t begin = end > ThreadRing::size ? end - ThreadRing::size : 0;
+            for (uint32_t i = begin; i != end; i++)
+            {
+                const Record& r = ring->records_[i % ThreadRing::size];
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+                        r.name_, r.phase_, r.ns_ * 0.001, pid, ring->tid_);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        return fclose(file) == 0;
+    }
+}
+
+ #define LOOP4R_TRACE_JOIN2(a, b) a##b
+ #define LOOP4R_TRACE_JOIN(a, b) LOOP4R_TRACE_JOIN2(a, b)
+ #define LOOP4R_TRACE_SCOPE(name) loop4rTrace::Scope LOOP4R_TRACE_JOIN(loop4rTraceScope_, __LINE__) (name)
+
+#else
+
+ #define LOOP4R_TRACE_SCOPE(name)
+
+#endif